@@ -90,7 +90,7 @@ Box* createBox(crystal::Vector3 position, crystal::Vector3 halfSize,
 {
 	Box* box = new Box(Application::globleWorld, position.x, position.y, position.z,
 		halfSize.x, halfSize.y, halfSize.z, 
-		crystal::Vector3(DEFAULT_WORLD_SIZE, DEFAULT_WORLD_SIZE, DEFAULT_WORLD_SIZE),//The size of the world is not used for now
+		Application::globleWorld->getWorldSize(),
 		m,canSleep);
 	CollisionBox* collider = nullptr;
 	if (addCollider)
@@ -258,7 +258,6 @@ int main()
 		deltaTime = currentTime - lastFrame;
 		lastFrame = currentTime;
 		if (deltaTime <= 0.0f) continue;
-		else if (deltaTime > 0.05f) deltaTime = 0.05f;
 		//Trigger Events
 		glfwPollEvents();
 		//Pause Game
@@ -270,7 +269,7 @@ int main()
 		//Run Physics
 		if (application->runPhysics)
 		{
-			application->world->runPhysics(deltaTime);
+			application->world->step(deltaTime);
 		}
 
 		//Render to depth texture from dirLight's perspective
@@ -348,8 +347,8 @@ int main()
 		glActiveTexture(GL_TEXTURE7);
 		glBindTexture(GL_TEXTURE_2D, depthTexture);
 
-		//Update particles
-		application->pworld->runPhysics(deltaTime);
+		//Update particles, which still step once a frame, so a stall mustn't make the step too long
+		application->pworld->runPhysics(deltaTime > 0.05f ? 0.05f : deltaTime);
 		
 		//Draw Particles
 		Explosion::program = shader.program;
@@ -458,9 +457,9 @@ void renderWorld(Shader &shader,bool depthOnly)
 	
 	application->display();//Common Stuff
 	//Draw each rigidbody
-	crystal::RigidBodyList bodyList = application->world->getRigidBodyList();
+	const crystal::RigidBodyList& bodyList = application->world->getRigidBodyList();
 
-	for (auto body : bodyList)
+	for (auto& body : bodyList)
 	{
 		if (body->isActive)
 		{
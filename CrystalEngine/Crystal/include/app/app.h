@@ -93,6 +93,7 @@ public:
 		world.reset(new crystal::World(maxContactNum, DEFAULT_CONTACT_RESOLVE_ITERATION));
 		pworld.reset(new crystal::ParticleWorld(maxPContactNum));
 		worldSize = crystal::Vector3(worldMaxX, worldMaxY, worldMaxZ);
+		world->setWorldSize(worldSize);
 		camera.reset(new Camera{ ratio });
 		dirLight.reset(new DirectionalLight());
 		Application::globleWorld = world.get();
@@ -67,7 +67,7 @@ public:
 		crystal::Vector3 wSize, crystal::Material m = crystal::Material::defaultMaterial, bool canSleep = true) :
 		halfSize(halfSizeX, halfSizeY, halfSizeZ)
 	{
-		position = crystal::Vector3(pX, pY, pZ);
+		setPosition(pX, pY, pZ);
 		worldSize = wSize;
 		//boxCollider = crystal::CollisionBox();
 		//boxCollider.halfSize = halfSize;
@@ -79,16 +79,16 @@ public:
 
 		//Set some default values
 		//Enable gravity by default
-		acceleration = crystal::Vector3::GRAVITY;
+		setAcceleration(crystal::Vector3::GRAVITY);
 		//Set Linear damping
-		linearDamping = (crystal::real)0.98f;
+		setLinearDamping((crystal::real)0.98f);
 		//Set Angular damping
-		angularDamping = (crystal::real)0.8f;
+		setAngularDamping((crystal::real)0.8f);
 		//Set mass according to volume
 		setMass(DEFAULT_DENSITY * halfSizeX * halfSizeY * halfSizeZ);
 		//Set inertial tensor
 		crystal::Matrix3 tensor;
-		tensor.setBlockInertiaTensor(halfSize, mass);
+		tensor.setBlockInertiaTensor(halfSize, getMass());
 		setInertiaTensor(tensor);
 
 		clearAccumulators();
@@ -130,14 +130,14 @@ public:
 		crystal::real drawSizeX = PLANE_DRAW_SIZE, crystal::real drawSizeY = PLANE_DRAW_SIZE) :
 		drawSizeX(drawSizeX),drawSizeY(drawSizeY),scale(1)
 	{
-		position = crystal::Vector3(pX, pY, pZ);
+		setPosition(pX, pY, pZ);
 		normal = planeNormal;
 		material = m;
 		setInverseMass(1.0f);
 		
 		//Set up rigid body
 		clearAccumulators();
-		acceleration = crystal::Vector3(0, 0, 0);
+		setAcceleration(0, 0, 0);
 
 	}
 
@@ -1,111 +1,44 @@
 #pragma once
 #include "core.h"
+#include "body_store.h"
+#include "slot_map.h"
+#include <unordered_map>
+
+//Marks a body with no value in a body index
+#define NO_BODY_INDEX 0xffffffff
 
 namespace crystal {
+
+	class CollisionPrimitive;
+
 	class RigidBody 
 	{
 	protected:
 
-		//holds inverse mass of the rigidbody
-		real inverseMass;
-
-		//holds mass of the rigidbody
-		real mass;
-		
-		//holds the linear position in world space
-		Vector3 position;
-
-		//holds the linear velocity in world space
-		Vector3 velocity;
-
-		/**
-		* Holds the acceleration of the rigid body.  This value
-		* can be used to set acceleration due to gravity (its primary
-		* use), or any other constant acceleration.
-		*/
-		Vector3 acceleration;
-
-		//holds the angular orientation in world space
-		Quaternion orientation;
-
-		//holds the angular velocity, or rotation of the rigid body in world space 
-		Vector3 rotation;
-		/** 
-		 * Holds the amount of damping applied to angular 
-		 * motion. Damping is required to remove energy added 
-		 * through numerical instability in the integrator. 
-		 */
-		real angularDamping;
-		/**
-		* Holds the amount of damping applied to linear
-		* motion. Damping is required to remove energy added
-		* through numerical instability in the integrator.
-		*/
-		real linearDamping;
-		/**
-		* Holds the accumulated force to be applied at the next
-		* integration step.
-		*/
-		Vector3 forceAccum;
-
-		/**
-		* Holds the accumulated torque to be applied at the next
-		* integration step.
-		*/
-		Vector3 torqueAccum;
-
-		//holds the transform matrix for converting between local space and world space
-		Matrix4 transformMatrix;
-
-		/** 
-		 * Holds the inverse of the bodys inertia tensor. The inertia 
-		 * tensor provided must not be degenerate (that would mean 
-		 * the body had zero inertia for spinning along one axis). 
-		 * As long as the tensor is finite, it will be invertible. 
-		 * The inverse tensor is used for similar reasons as those 
-		 * for the use of inverse mass. 
-		 * 
-		 * The inertia tensor, unlike the other variables that define *
-		 a rigid body, is given in body space. 
-		 * 
-		 * @see inverseMass 
-		 */
-		Matrix3 inverseInertiaTensor;
-
 		/**
-		* Holds the inverse inertia tensor of the body in world
-		* space. The inverse inertia tensor member is specified in
-		* the body's local space.
+		* Holds the store holding the state of the body, and the body's
+		* slot in it. The body belongs to the loose store until it is
+		* added to a world.
 		*
-		* @see inverseInertiaTensor
+		* @see BodyStore
 		*/
-		Matrix3 inverseInertiaTensorWorld;
+		BodyStore* store;
+		unsigned slot;
 
-		/**
-		* Holds the linear acceleration of the rigid body, for the
-		* previous frame.
-		*/
-		Vector3 lastFrameAcceleration;
+		friend class BodyStore;
 
 		/**
-		* A body can be put to sleep to avoid it being updated
-		* by the integration functions or affected by collisions
-		* with the world.
+		* Holds the handle of the body in the world it was added to, and
+		* the collider the world attached to it, if any. Both are cleared
+		* when the world removes the body.
 		*/
-		bool isAwake;
+		BodyHandle handle;
+		CollisionPrimitive* collider;
 
-		/**
-		* Some bodies may never be allowed to fall asleep.
-		* User controlled bodies, for example, should be
-		* always awake.
-		*/
-		bool canSleep;
+		friend class World;
 
-		/**
-		* Holds the amount of motion of the body. This is a recency
-		* weighted mean that can be used to put a body to sleep.
-		*/
-		real motion;
+		//holds mass of the rigidbody
+		real mass;
 
 		int id;//Id is used to uniquely mark rigidbodies
 
@@ -119,8 +52,43 @@ namespace crystal {
 			return id;
 		}
 
-		RigidBody() :tag(""), canSleep(true), linearFactor(1.0f), angularFactor(1.0f), isActive(true) 
-		{ id = RigidBody::CurrentID++; }
+		//Gets the handle of the body in its world
+		BodyHandle getHandle() const
+		{
+			return handle;
+		}
+
+		//Gets the collider attached to the body when it was added to its world
+		CollisionPrimitive* getCollider() const
+		{
+			return collider;
+		}
+
+		//Gets the store holding the state of the body
+		const BodyStore* getStore() const
+		{
+			return store;
+		}
+
+		//Gets the slot of the body in its store
+		unsigned getSlot() const
+		{
+			return slot;
+		}
+
+		RigidBody() :store(NULL), collider(NULL), tag(""), isActive(true)
+		{
+			id = RigidBody::CurrentID++;
+			BodyStore::getLooseStore().add(this);
+		}
+
+		//Copies the state of another body into a new slot of the loose store
+		RigidBody(const RigidBody& other);
+
+		//Copies the state of another body, keeping this body's id and slot
+		RigidBody& operator=(const RigidBody& other);
+
+		virtual ~RigidBody();
 
 		/* A tag string attached to the rigidbody */
 		String tag;
@@ -130,8 +98,26 @@ namespace crystal {
 		/**  A factor controls how fast the body moves.
 		* The linear acceleration is multiplied by this value before velocity calculation
 		*/
-		real linearFactor;
-		real angularFactor;//Affects angular accelerations
+		void setLinearFactor(real factor)
+		{
+			store->linearFactor[slot] = factor;
+		}
+
+		real getLinearFactor() const
+		{
+			return store->linearFactor[slot];
+		}
+
+		//Affects angular accelerations
+		void setAngularFactor(real factor)
+		{
+			store->angularFactor[slot] = factor;
+		}
+
+		real getAngularFactor() const
+		{
+			return store->angularFactor[slot];
+		}
 
 		virtual bool isPrimitive() { return false; };
 		/** 
@@ -146,6 +132,7 @@ namespace crystal {
 		/** 
 		 * Add a force to the center of the rigid body 
 		 * The force is expressed in WORLD coordinates
+		 * Adding a force wakes the body up.
 		 */
 		void addForce(const Vector3& force);
 
@@ -153,8 +140,8 @@ namespace crystal {
 
 		void clearAccumulators()
 		{
-			forceAccum.clear();
-			torqueAccum.clear();
+			store->forceAccum.clear(slot);
+			store->torqueAccum.clear(slot);
 		}
 
 		/**
@@ -238,29 +225,32 @@ namespace crystal {
 
 		real getInverseMass() const
 		{
-			return inverseMass;
+			return store->inverseMass[slot];
 		}
 
 		bool hasFiniteMass() const
 		{
-			return inverseMass > 0.0f;
+			return store->inverseMass[slot] > 0.0f;
 		}
 
 		void setAcceleration(Vector3 acc)
 		{
-			this->acceleration = acc;
+			store->acceleration.set(slot, acc);
 		}
 
 		void setAcceleration(real x, real y, real z)
 		{
-			this->acceleration.x = x;
-			this->acceleration.y = y;
-			this->acceleration.z = z;
+			store->acceleration.set(slot, Vector3(x, y, z));
+		}
+
+		Vector3 getAcceleration() const
+		{
+			return store->acceleration.get(slot);
 		}
 
 		void setInverseMass(real mass)
 		{
-			inverseMass = mass;
+			store->inverseMass[slot] = mass;
 		}
 
 		/**
@@ -441,6 +431,23 @@ namespace crystal {
 		*/
 		Vector3 getLastFrameAcceleration() const;
 
+		/**
+		* Gets the position of the rigid body the given fraction of the
+		* way from where it was when its store last saved its state to
+		* where it is now. Used to draw the body between two fixed
+		* steps of the world.
+		*
+		* @see World::step
+		*/
+		Vector3 getInterpolatedPosition(real alpha) const;
+
+		/**
+		* Gets the orientation of the rigid body the given fraction of
+		* the way from its orientation when its store last saved its
+		* state to its orientation now, taking the shorter way round.
+		*/
+		Quaternion getInterpolatedOrientation(real alpha) const;
+
 		/**
 		* Sets the position of the rigid body.
 		*
@@ -596,7 +603,9 @@ namespace crystal {
 		*/
 		Matrix4 getTransform() const 
 		{
-			return transformMatrix;
+			Matrix4 transform;
+			store->transformMatrix.get(slot, transform);
+			return transform;
 		}
 		/**
 		* Sets the velocity of the rigid body.
@@ -694,7 +703,7 @@ namespace crystal {
 		*/
 		bool getAwake() const
 		{
-			return isAwake;
+			return store->isAwake[slot] != 0;
 		}
 
 		/**
@@ -707,13 +716,21 @@ namespace crystal {
 		*/
 		void setAwake(const bool awake = true);
 
+		/**
+		* Gets the recency weighted mean of the body's squared speeds.
+		*/
+		real getMotion() const
+		{
+			return store->motion[slot];
+		}
+
 		/**
 		* Returns true if the body is allowed to go to sleep at
 		* any time.
 		*/
 		bool getCanSleep() const
 		{
-			return canSleep;
+			return store->canSleep[slot] != 0;
 		}
 
 		/**
@@ -726,4 +743,35 @@ namespace crystal {
 		*/
 		void setCanSleep(const bool canSleep = true);
 	};
-}
\ No newline at end of file
+
+	/**
+	* Holds a value for each of a set of bodies, NO_BODY_INDEX for the
+	* bodies not set. The bodies of one store are looked up by their
+	* slot, so the index never grows past the size of that store: the
+	* store is taken from the first body set while the index is empty.
+	* Bodies of any other store are kept in a hash map.
+	*
+	* Values are cleared body by body, so a frame's bodies can be
+	* cleared without going through the whole index.
+	*/
+	class BodyIndex
+	{
+	protected:
+		const BodyStore* store;
+		std::vector<unsigned> slots;
+		std::unordered_map<const RigidBody*, unsigned> others;
+
+		//Holds the number of bodies set, to know when the store can change
+		unsigned setCount;
+
+	public:
+		BodyIndex() :store(NULL), setCount(0) {}
+
+		unsigned get(const RigidBody* body) const;
+
+		void set(const RigidBody* body, unsigned value);
+
+		//Sets the value of the body back to NO_BODY_INDEX
+		void clear(const RigidBody* body);
+	};
+}
@@ -0,0 +1,288 @@
+#pragma once
+#include "core.h"
+#include <vector>
+
+//The number of slots integrated together, one per SIMD lane
+#define BODY_STORE_LANES 4
+//The fewest slots a worker integrates or updates in one task
+#define BODY_STORE_SLOTS_PER_TASK 256
+
+namespace crystal {
+
+	class RigidBody;
+	class WorkerPool;
+
+	/**
+	* Holds the state of a set of rigid bodies in structure-of-arrays
+	* form: every component of every value has an array of its own,
+	* with one entry per body. A rigid body reads and writes its state
+	* through its slot in a store, so the loops over all the bodies,
+	* integration and the calculation of derived data, run down dense
+	* arrays four bodies at a time.
+	*
+	* Each world keeps the bodies added to it in its own store. Bodies
+	* that belong to no world are kept in the loose store. A freed slot
+	* is filled by moving the last body into it, so the slots of a store
+	* stay dense, but a body's slot may change when another body leaves.
+	*
+	* The bodies don't depend on each other while they are integrated,
+	* so the slots can be split into ranges for a pool of workers. The
+	* ranges start on a multiple of BODY_STORE_LANES slots, so no two workers share
+	* a group, and the result is the same for any number of workers.
+	*/
+	class BodyStore
+	{
+		friend class RigidBody;
+
+	protected:
+		//Holds the three components of a vector for each body
+		struct VectorArray
+		{
+			std::vector<real> x, y, z;
+
+			Vector3 get(unsigned i) const
+			{
+				return Vector3(x[i], y[i], z[i]);
+			}
+
+			void set(unsigned i, const Vector3& v)
+			{
+				x[i] = v.x;
+				y[i] = v.y;
+				z[i] = v.z;
+			}
+
+			void add(unsigned i, const Vector3& v)
+			{
+				x[i] += v.x;
+				y[i] += v.y;
+				z[i] += v.z;
+			}
+
+			void clear(unsigned i)
+			{
+				x[i] = y[i] = z[i] = 0;
+			}
+		};
+
+		//Holds the four components of a quaternion for each body
+		struct QuaternionArray
+		{
+			std::vector<real> r, i, j, k;
+
+			Quaternion get(unsigned n) const
+			{
+				return Quaternion(r[n], i[n], j[n], k[n]);
+			}
+
+			void set(unsigned n, const Quaternion& q)
+			{
+				r[n] = q.r;
+				i[n] = q.i;
+				j[n] = q.j;
+				k[n] = q.k;
+			}
+		};
+
+		//Holds the first N entries of a matrix for each body
+		template<unsigned N>
+		struct MatrixArray
+		{
+			std::vector<real> data[N];
+
+			template<class Matrix>
+			void get(unsigned i, Matrix& m) const
+			{
+				for (unsigned n = 0; n < N; n++) m.data[n] = data[n][i];
+			}
+
+			template<class Matrix>
+			void set(unsigned i, const Matrix& m)
+			{
+				for (unsigned n = 0; n < N; n++) data[n][i] = m.data[n];
+			}
+		};
+
+		//holds the linear position in world space
+		VectorArray position;
+
+		//holds the linear velocity in world space
+		VectorArray velocity;
+
+		/**
+		* Holds the acceleration of the rigid body.  This value
+		* can be used to set acceleration due to gravity (its primary
+		* use), or any other constant acceleration.
+		*/
+		VectorArray acceleration;
+
+		//holds the angular orientation in world space
+		QuaternionArray orientation;
+
+		//holds the angular velocity, or rotation of the rigid body in world space
+		VectorArray rotation;
+
+		//Hold the accumulated force and torque to be applied at the next integration step
+		VectorArray forceAccum;
+		VectorArray torqueAccum;
+
+		//Holds the linear acceleration of the rigid body, for the previous frame
+		VectorArray lastFrameAcceleration;
+
+		//Holds the inverse inertia tensor in body space, and in world space
+		MatrixArray<9> inverseInertiaTensor;
+		MatrixArray<9> inverseInertiaTensorWorld;
+
+		//holds the transform matrix for converting between local space and world space
+		MatrixArray<12> transformMatrix;
+
+		std::vector<real> inverseMass;
+
+		/**
+		* Hold the amount of damping applied to linear and angular
+		* motion. Damping is required to remove energy added
+		* through numerical instability in the integrator.
+		*/
+		std::vector<real> linearDamping;
+		std::vector<real> angularDamping;
+
+		/**
+		* Hold the damping raised to the power of dragDuration, the
+		* fraction of the velocity kept over a step of that duration.
+		* They are worked out again when the duration changes.
+		*/
+		std::vector<real> linearDrag;
+		std::vector<real> angularDrag;
+		real dragDuration;
+
+		//Hold the factors the linear and angular accelerations are multiplied by
+		std::vector<real> linearFactor;
+		std::vector<real> angularFactor;
+
+		//Holds the recency weighted mean of the motion of each body
+		std::vector<real> motion;
+
+		/**
+		* Hold the position and orientation of each body when the state
+		* was last saved, to interpolate from when the bodies are drawn
+		* between two steps.
+		*/
+		VectorArray lastPosition;
+		QuaternionArray lastOrientation;
+
+		//Hold whether each body is awake, and whether it may fall asleep
+		std::vector<unsigned char> isAwake;
+		std::vector<unsigned char> canSleep;
+
+		//Holds the body in each slot
+		std::vector<RigidBody*> bodies;
+
+		//Holds every array of reals above, to grow and move all of them at once
+		std::vector<std::vector<real>*> columns;
+
+		/**
+		* Takes a new slot at the end of the store for the given body,
+		* with the state of a newly created body.
+		*/
+		void add(RigidBody* body);
+
+		/**
+		* Frees the slot of the given body, moving the last body of the
+		* store into it.
+		*/
+		void remove(RigidBody* body);
+
+		//Copies the state in a slot of another store into a slot of this one
+		void copySlot(unsigned slot, const BodyStore& from, unsigned fromSlot);
+
+		//Works out the drag of every body for the given duration, if it changed
+		void updateDrag(real duration);
+
+		/**
+		* Integrates the awake bodies in the given range of slots, which
+		* must have their drag worked out for the duration.
+		*/
+		void integrateRange(unsigned first, unsigned last, real duration);
+
+		//Calculates the derived data of the bodies in the given range, or of the awake ones
+		void calculateDerivedDataRange(unsigned first, unsigned last, bool awakeOnly);
+
+		//Does the work of startFrame for the bodies in the given range
+		void startFrameRange(unsigned first, unsigned last);
+
+		//Saves the state of the bodies in the given range
+		void saveStateRange(unsigned first, unsigned last);
+
+		/**
+		* Integrate and calculate the derived data of the bodies from the
+		* given slot, as many as the lane type handles at a time. Bodies
+		* left out by the mask are not changed.
+		*/
+		template<class Lanes>
+		void integrateSlots(unsigned first, real duration, real bias);
+		template<class Lanes>
+		void calculateDerivedDataSlots(unsigned first, bool awakeOnly);
+
+	public:
+		/**
+		* Takes the bodies four at a time with SSE when the target
+		* supports it. One at a time gives the same result and is kept
+		* for checking.
+		*/
+		static bool useSSE;
+
+		BodyStore();
+
+		/**
+		* Hands the bodies still in the store over to the loose store,
+		* so they can outlive their world.
+		*/
+		~BodyStore();
+
+		BodyStore(const BodyStore&) = delete;
+		BodyStore& operator=(const BodyStore&) = delete;
+
+		/**
+		* Gets the store of the bodies that belong to no world. It is
+		* never destroyed, so worlds can hand their bodies over to it
+		* while the program shuts down.
+		*/
+		static BodyStore& getLooseStore();
+
+		/**
+		* Moves a body from its store into this one. Its state moves
+		* with it.
+		*/
+		void adopt(RigidBody* body);
+
+		unsigned getBodyCount() const
+		{
+			return bodies.size();
+		}
+
+		/**
+		* Integrates all the awake bodies of the store forward in time
+		* by the given duration, and calculates their derived data. If
+		* workers are given, the slots are shared out between them.
+		*/
+		void integrate(real duration, WorkerPool* workers = NULL);
+
+		/**
+		* Clears the accumulated forces and torques of all the bodies,
+		* and calculates the derived data of the awake ones. If workers
+		* are given, the slots are shared out between them.
+		*/
+		void startFrame(WorkerPool* workers = NULL);
+
+		/**
+		* Saves the position and orientation of all the bodies, for
+		* RigidBody::getInterpolatedPosition and getInterpolatedOrientation
+		* to interpolate from. If workers are given, the slots are shared
+		* out between them.
+		*/
+		void saveState(WorkerPool* workers = NULL);
+
+		//Saves the position and orientation of one body of the store
+		void saveState(RigidBody* body);
+	};
+}
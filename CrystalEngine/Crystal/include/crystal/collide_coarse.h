@@ -1,5 +1,20 @@
 #pragma once
 #include "body.h"
+#include "collide_fine.h"
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+//The amount the bounds of colliders are enlarged by in the broad phases. A collider only has to be
+//re-inserted into the dynamic tree once it moves out of its enlarged volume
+#define DEFAULT_AABB_MARGIN 0.1f
+//The default edge length of a cell in the spatial grid
+#define DEFAULT_GRID_CELL_SIZE 2.0f
+//Colliders covering more cells than this are not put in the spatial grid but checked against everything
+#define DEFAULT_GRID_MAX_CELLS 64
+//The most cells the spatial grid has along an axis. Finer cell sizes are raised to keep within it
+#define MAX_GRID_CELLS_PER_AXIS (1u << 20)
 
 namespace crystal {
 	/**
@@ -7,7 +22,7 @@ namespace crystal {
 	*/
 	struct PotentialContact
 	{
-		RigidBody* body[2];
+		CollisionPrimitive* collider[2];
 	};
 
 	/**
@@ -20,7 +35,7 @@ namespace crystal {
 		real radius;
 
 		BoundingSphere(const Vector3& center, real radius) :center(center), radius(radius) {}
-		
+
 		/**
 		* Creates a bounding sphere to enclose the two given bounding
 		* spheres.
@@ -50,11 +65,77 @@ namespace crystal {
 		real getGrowth(const BoundingSphere& other) const;
 	};
 
+	/**
+	* Represents an axis aligned bounding box that can be tested for overlap.
+	*/
+	struct BoundingBox
+	{
+	public:
+		Vector3 center;
+		Vector3 halfSize;
+
+		BoundingBox() {}
+
+		BoundingBox(const Vector3& center, const Vector3& halfSize) :center(center), halfSize(halfSize) {}
+
+		/**
+		* Creates a bounding box to enclose the two given bounding
+		* boxes.
+		*/
+		BoundingBox(const BoundingBox& b1, const BoundingBox& b2);
+
+		/**
+		* Fills the given box with the world space bounds of a collider.
+		* Returns false if the collider has no finite bounds (e.g. a plane).
+		*/
+		static bool fromPrimitive(const CollisionPrimitive& primitive, BoundingBox* box);
+
+		bool overlaps(const BoundingBox& other) const
+		{
+			return real_abs(center.x - other.center.x) <= halfSize.x + other.halfSize.x &&
+				real_abs(center.y - other.center.y) <= halfSize.y + other.halfSize.y &&
+				real_abs(center.z - other.center.z) <= halfSize.z + other.halfSize.z;
+		}
+
+		//Checks whether the other box lies completely inside this one
+		bool contains(const BoundingBox& other) const;
+
+		//Enlarges the box by the given margin on every side
+		void fatten(real margin)
+		{
+			halfSize.x += margin;
+			halfSize.y += margin;
+			halfSize.z += margin;
+		}
+
+		Vector3 getMin() const { return center - halfSize; }
+
+		Vector3 getMax() const { return center + halfSize; }
+
+		/**
+		* Returns the surface area of the box. Surface area is a better
+		* estimate than volume of how likely a box is to be hit by a query,
+		* so it is used to decide how to build and walk the tree.
+		*/
+		real getSize() const
+		{
+			return ((real)8.0) * (halfSize.x * halfSize.y + halfSize.y * halfSize.z + halfSize.z * halfSize.x);
+		}
+
+		/**
+		* Reports how much the surface area of this box would grow to
+		* incorporate the given box.
+		*/
+		real getGrowth(const BoundingBox& other) const;
+	};
+
 	/**
 	* A base class for nodes in a bounding volume hierarchy.
 	*
 	* This class uses a binary tree to store the bounding
-	* volumes.
+	* volumes. Leaf nodes keep their identity for their whole
+	* life in the tree, so a leaf pointer can be used as a handle
+	* to move or remove a collider later.
 	*/
 	template<class BoundingVolumeClass>
 	class BVHNode
@@ -66,27 +147,27 @@ namespace crystal {
 		BoundingVolumeClass volume;
 
 		/**
-		* Holds the rigid body at this node of the hierarchy.
-		* Only leaf nodes can have a rigid body defined (see isLeaf).
-		* Note that it is possible to rewrite the algorithms in this
-		* class to handle objects at all levels of the hierarchy,
-		* but the code provided ignores this vector unless firstChild
-		* is NULL.
+		* Holds the collider at this node of the hierarchy.
+		* Only leaf nodes can have a collider defined (see isLeaf).
 		*/
-		RigidBody* body;
+		CollisionPrimitive* collider;
 
 		//direct parent node
 		BVHNode* parent;
 
 		//child nodes. NULL for both if the node is leaf node
-		BVHNode* chidren[2];
+		BVHNode* children[2];
 
-		BVHNode(BVHNode* parent,BoundingVolumeClass& volume,RigidBody* body = NULL)
-			:volume(volume), body(body), parent(parent)
+		//Height of the subtree below this node. Leaf nodes have a height of 0
+		int height;
+
+		BVHNode(BVHNode* parent, const BoundingVolumeClass& volume, CollisionPrimitive* collider = NULL)
+			:volume(volume), collider(collider), parent(parent), height(0)
 		{
-			chidren[0] = chidren[1] = NULL;
+			children[0] = children[1] = NULL;
 		}
 
+		//Deletes the whole subtree under this node
 		~BVHNode();
 
 		/**
@@ -94,24 +175,34 @@ namespace crystal {
 		*/
 		bool isLeaf() const
 		{
-			return body != NULL;
+			return collider != NULL;
 		}
 
 		/**
 		* Checks the potential contacts from this node downwards in
-		* the hierarchy, writing them to the given array (up to the
-		* given limit). Returns the number of potential contacts it
-		* found.
+		* the hierarchy, appending them to the given list.
+		*/
+		void getPotentialContacts(std::vector<PotentialContact>& contacts) const;
+
+		/**
+		* Appends the colliders of all leaves under this node whose volume
+		* overlaps the given volume to the list.
 		*/
-		unsigned getPotentialContacts(PotentialContact* contacts,
-			unsigned limit) const;
+		void query(const BoundingVolumeClass& queryVolume, std::vector<CollisionPrimitive*>& result) const;
 
 		/**
-		* Inserts the given rigid body, with the given bounding volume,
-		* into the hierarchy. This may involve the creation of
-		* further bounding volume nodes.
+		* Inserts the given leaf node into the hierarchy below this node,
+		* which must be the root. This creates one new bounding volume
+		* node. Returns the new root of the hierarchy.
 		*/
-		void insert(const BoundingVolumeClass& newVolume, const RigidBody* const newBody);
+		BVHNode* insert(BVHNode* leaf);
+
+		/**
+		* Takes this leaf out of the hierarchy without deleting it. Its
+		* sibling takes the place of their parent, which is deleted.
+		* Returns the new root of the hierarchy (NULL if it is empty).
+		*/
+		BVHNode* detach();
 
 		/**
 		* For non-leaf nodes, this method recalculates the bounding volume
@@ -120,7 +211,7 @@ namespace crystal {
 		void recalculateBoundingVolume(bool recurse = true);
 
 	protected:
-       /**
+		/**
 		* Checks for overlapping between nodes in the hierarchy. Note
 		* that any bounding volume should have an overlaps method implemented
 		* that checks for overlapping with another object of its own type.
@@ -129,63 +220,54 @@ namespace crystal {
 
 		/**
 		* Checks the potential contacts between this node and the given
-		* other node, writing them to the given array (up to the
-		* given limit). Returns the number of potential contacts it
-		* found.
+		* other node, appending them to the given list.
 		*/
-		unsigned getPotentialContactsWith(
+		void getPotentialContactsWith(
 			const BVHNode<BoundingVolumeClass> *other,
-			PotentialContact* contacts,
-			unsigned limit) const;
+			std::vector<PotentialContact>& contacts) const;
+
+		/**
+		* Rotates the tree around this node if its subtrees are out of
+		* balance. Returns the node that takes this node's place.
+		*/
+		BVHNode* balance();
 	};
 
 	template<class BoundingVolumeClass>
-	unsigned BVHNode<BoundingVolumeClass>::getPotentialContacts(PotentialContact* contacts, unsigned limit) const
+	void BVHNode<BoundingVolumeClass>::getPotentialContacts(std::vector<PotentialContact>& contacts) const
 	{
-		if (isLeaf() || limit == 0) return 0;
-		return chidren[0]->getPotentialContactsWith(chidren[1], contacts, limit);
+		if (isLeaf()) return;
+		// Pairs inside each subtree, then pairs that straddle both of them
+		children[0]->getPotentialContacts(contacts);
+		children[1]->getPotentialContacts(contacts);
+		children[0]->getPotentialContactsWith(children[1], contacts);
+	}
+
+	template<class BoundingVolumeClass>
+	void BVHNode<BoundingVolumeClass>::query(const BoundingVolumeClass& queryVolume,
+		std::vector<CollisionPrimitive*>& result) const
+	{
+		if (!volume.overlaps(queryVolume)) return;
+		if (isLeaf())
+		{
+			result.push_back(collider);
+			return;
+		}
+		children[0]->query(queryVolume, result);
+		children[1]->query(queryVolume, result);
 	}
 
 	template<class BoundingVolumeClass>
 	bool BVHNode<BoundingVolumeClass>::overlaps(const BVHNode<BoundingVolumeClass>* other) const
 	{
-		return volume->overlaps(other->volume);
+		return volume.overlaps(other->volume);
 	}
 
 	template<class BoundingVolumeClass>
 	BVHNode<BoundingVolumeClass>::~BVHNode()
 	{
-		// If we don't have a parent, then we ignore the sibling
-		// processing
-		if (parent)
-		{
-			// Find our sibling
-			BVHNode<BoundingVolumeClass> *sibling;
-			if (parent->children[0] == this) sibling = parent->children[1];
-			else sibling = parent->children[0];
-
-			// Write its data to our parent
-			parent->volume = sibling->volume;
-			parent->body = sibling->body;
-			parent->children[0] = sibling->children[0];
-			if(sibling->chidren[0]) sibling->chidren[0]->parent = parent;
-			parent->children[1] = sibling->children[1];
-			if (sibling->chidren[1]) sibling->chidren[1]->parent = parent;
-			// Delete the sibling (we blank its parent and
-			// children to avoid processing/deleting them)
-			sibling->parent = NULL;
-			sibling->body = NULL;
-			sibling->children[0] = NULL;
-			sibling->children[1] = NULL;
-			delete sibling;
-
-			// Recalculate the parent's bounding volume
-			parent->recalculateBoundingVolume();
-		}
-
-		// Delete our children (again we remove their
-		// parent data so we don't try to process their siblings
-		// as they are deleted).
+		// Delete our children (we remove their parent data so
+		// they don't try to process anything while being deleted).
 		if (children[0]) {
 			children[0]->parent = NULL;
 			delete children[0];
@@ -197,32 +279,103 @@ namespace crystal {
 	}
 
 	template<class BoundingVolumeClass>
-	void BVHNode<BoundingVolumeClass>::insert(const BoundingVolumeClass& newVolume, const RigidBody* const newBody)
+	BVHNode<BoundingVolumeClass>* BVHNode<BoundingVolumeClass>::insert(BVHNode<BoundingVolumeClass>* leaf)
 	{
-		//If this is leaf node, simply append a new node as its subling and add a parent
-		if (this->isLeaf())
+		// Find the best sibling for the new leaf. We walk down giving the
+		// leaf to whichever child would grow the least, and stop when
+		// pairing it with the current node is cheaper than going deeper.
+		BVHNode* sibling = this;
+		while (!sibling->isLeaf())
+		{
+			real size = sibling->volume.getSize();
+			real combinedSize = BoundingVolumeClass(sibling->volume, leaf->volume).getSize();
+
+			// Cost of making a new parent for this node and the leaf
+			real cost = 2 * combinedSize;
+			// Minimum cost of pushing the leaf further down
+			real inheritanceCost = 2 * (combinedSize - size);
+
+			real childCost[2];
+			for (unsigned i = 0; i < 2; i++)
+			{
+				BVHNode* child = sibling->children[i];
+				childCost[i] = inheritanceCost + child->volume.getGrowth(leaf->volume);
+				if (child->isLeaf()) childCost[i] += child->volume.getSize();
+			}
+
+			if (cost < childCost[0] && cost < childCost[1]) break;
+			sibling = childCost[0] <= childCost[1] ? sibling->children[0] : sibling->children[1];
+		}
+
+		// Create a new parent for the sibling and the leaf
+		BVHNode* oldParent = sibling->parent;
+		BVHNode* newParent = new BVHNode(oldParent, BoundingVolumeClass(sibling->volume, leaf->volume));
+		newParent->height = sibling->height + 1;
+		newParent->children[0] = sibling;
+		newParent->children[1] = leaf;
+		sibling->parent = newParent;
+		leaf->parent = newParent;
+
+		BVHNode* root = this;
+		if (oldParent)
 		{
-			children[0] = new BVHNode{ this,volume,body };
-			children[1] = new BVHNode{this,newVolume,newBody};
-			this->body = NULL;
-			// We need to recalculate our bounding volume
-			recalculateBoundingVolume();
+			if (oldParent->children[0] == sibling) oldParent->children[0] = newParent;
+			else oldParent->children[1] = newParent;
 		}
-		// Otherwise we need to work out which child gets to keep
-		// the inserted body. We give it to whoever would grow the
-		// least to incorporate it.
 		else
 		{
-			if (children[0]->volume.getGrowth(newVolume)
-				> children[1]->volume.getGrowth(newVolume))
-			{
-				children[1]->insert(newVolume, newBody);
-			}
-			else
-			{
-				children[0]->insert(newVolume, newBody);
-			}
+			root = newParent;
+		}
+
+		// Walk back up fixing heights and volumes
+		BVHNode* node = newParent->parent;
+		while (node)
+		{
+			node = node->balance();
+			if (!node->parent) root = node;
+			node->recalculateBoundingVolume(false);
+			node = node->parent;
+		}
+		return root;
+	}
+
+	template<class BoundingVolumeClass>
+	BVHNode<BoundingVolumeClass>* BVHNode<BoundingVolumeClass>::detach()
+	{
+		// The only node in the tree
+		if (!parent) return NULL;
+
+		BVHNode* oldParent = parent;
+		BVHNode* grandParent = oldParent->parent;
+		BVHNode* sibling = oldParent->children[0] == this ? oldParent->children[1] : oldParent->children[0];
+
+		// Unlink the old parent so deleting it doesn't take our subtrees with it
+		oldParent->children[0] = oldParent->children[1] = NULL;
+		parent = NULL;
+
+		if (!grandParent)
+		{
+			sibling->parent = NULL;
+			delete oldParent;
+			return sibling;
 		}
+
+		// Put the sibling in the place of our old parent
+		if (grandParent->children[0] == oldParent) grandParent->children[0] = sibling;
+		else grandParent->children[1] = sibling;
+		sibling->parent = grandParent;
+		delete oldParent;
+
+		BVHNode* root = grandParent;
+		BVHNode* node = grandParent;
+		while (node)
+		{
+			node = node->balance();
+			node->recalculateBoundingVolume(false);
+			root = node;
+			node = node->parent;
+		}
+		return root;
 	}
 
 	template<class BoundingVolumeClass>
@@ -237,59 +390,444 @@ namespace crystal {
 			children[0]->volume,
 			children[1]->volume
 		);
+		height = 1 + (children[0]->height > children[1]->height ? children[0]->height : children[1]->height);
 
 		// Recurse up the tree
-		if (parent) parent->recalculateBoundingVolume(true);
+		if (recurse && parent) parent->recalculateBoundingVolume(true);
 	}
 
 	template<class BoundingVolumeClass>
-	unsigned BVHNode<BoundingVolumeClass>::getPotentialContactsWith(
-		const BVHNode<BoundingVolumeClass> *other, PotentialContact* contacts,
-		unsigned limit) const
+	BVHNode<BoundingVolumeClass>* BVHNode<BoundingVolumeClass>::balance()
 	{
-		//no contact or reach limit
-		if (!overlaps(other) || limit <= 0) return;
+		if (isLeaf() || height < 2) return this;
+
+		int diff = children[1]->height - children[0]->height;
+		if (diff >= -1 && diff <= 1) return this;
+
+		// Promote the taller child (c) and give its shorter grandchild to us
+		unsigned tall = diff > 1 ? 1 : 0;
+		BVHNode* c = children[tall];
+		BVHNode* g0 = c->children[0];
+		BVHNode* g1 = c->children[1];
+
+		// c takes our place
+		c->parent = parent;
+		if (parent)
+		{
+			if (parent->children[0] == this) parent->children[0] = c;
+			else parent->children[1] = c;
+		}
+		c->children[0] = this;
+		parent = c;
+
+		// The taller grandchild stays with c, the other one moves to us
+		BVHNode* keep = g0->height > g1->height ? g0 : g1;
+		BVHNode* give = keep == g0 ? g1 : g0;
+		c->children[1] = keep;
+		children[tall] = give;
+		give->parent = this;
+
+		recalculateBoundingVolume(false);
+		c->recalculateBoundingVolume(false);
+		return c;
+	}
+
+	template<class BoundingVolumeClass>
+	void BVHNode<BoundingVolumeClass>::getPotentialContactsWith(
+		const BVHNode<BoundingVolumeClass> *other, std::vector<PotentialContact>& contacts) const
+	{
+		//no contact
+		if (!overlaps(other)) return;
 
 		//both leaf nodes. Record contact
 		if (isLeaf() && other->isLeaf())
 		{
-			contacts->body[0] = body;
-			contacts->body[1] = other->body;
-			return 1;
+			PotentialContact contact;
+			contact.collider[0] = collider;
+			contact.collider[1] = other->collider;
+			contacts.push_back(contact);
+			return;
 		}
 
 		// Determine which node to descend into. If either is
 		// a leaf, then we descend the other. If both are branches,
 		// then we use the one with the largest size.
-		if (other->isLeaf() || ((!isLeaf()) && volume -> getSize() >= other->volume->getSize()))
+		if (other->isLeaf() || ((!isLeaf()) && volume.getSize() >= other->volume.getSize()))
 		{
 			//Descend into this node
-			unsigned count = children[0]->getPotentialContactsWith(other,contacts,limit);
-			//Check we have enough slots to do the other side too
-			if (limit > count)
+			children[0]->getPotentialContactsWith(other, contacts);
+			children[1]->getPotentialContactsWith(other, contacts);
+		}
+		else
+		{
+			// Recurse into the other node
+			getPotentialContactsWith(other->children[0], contacts);
+			getPotentialContactsWith(other->children[1], contacts);
+		}
+	}
+
+	/**
+	* The available broad phase algorithms of the world.
+	*/
+	enum BroadphaseType
+	{
+		//Check every collider against every other collider
+		BROADPHASE_BRUTE_FORCE,
+		//Keep the colliders in a dynamic bounding volume tree
+		BROADPHASE_AABB_TREE,
+		//Keep the colliders sorted along each axis
+		BROADPHASE_SWEEP_AND_PRUNE,
+		//Hash the colliders into a uniform grid covering the world
+		BROADPHASE_SPATIAL_GRID
+	};
+
+	/**
+	* The basic polymorphic interface for broad phase collision detection.
+	* A broad phase keeps track of a set of colliders and reports the pairs
+	* that may be touching, which are then passed to the fine collision
+	* detection routines.
+	*/
+	class Broadphase
+	{
+	public:
+		virtual ~Broadphase() {}
+
+		//Starts tracking a collider
+		virtual void add(CollisionPrimitive* collider) = 0;
+
+		//Stops tracking a collider
+		virtual void remove(CollisionPrimitive* collider) = 0;
+
+		/**
+		* Refreshes the bounds of all colliders. This should be called
+		* after the colliders' internals have been calculated for the frame.
+		*/
+		virtual void update() = 0;
+
+		/**
+		* Appends all pairs of colliders that may be in contact to the
+		* given list. Each pair is reported once.
+		*/
+		virtual void getPotentialContacts(std::vector<PotentialContact>& contacts) = 0;
+
+		/**
+		* Forgets the record of the pairs that started and stopped
+		* overlapping, for broad phases that keep one. Called once the
+		* changes have been read.
+		*/
+		virtual void clearPairChanges() {}
+	};
+
+	/**
+	* Reports every pair of colliders. This is O(n^2), it is only kept
+	* as a reference to compare the other broad phases against.
+	*/
+	class BruteForceBroadphase : public Broadphase
+	{
+	protected:
+		std::vector<CollisionPrimitive*> colliders;
+
+	public:
+		void add(CollisionPrimitive* collider);
+		void remove(CollisionPrimitive* collider);
+		void update() {}
+		void getPotentialContacts(std::vector<PotentialContact>& contacts);
+	};
+
+	/**
+	* An incrementally updated dynamic bounding volume tree. Each collider
+	* is stored in a leaf with an enlarged ("fat") bounding box, so it only
+	* has to be moved in the tree once it leaves that box. Colliders without
+	* finite bounds (planes) are kept outside the tree and paired with
+	* every other collider.
+	*/
+	class AABBTreeBroadphase : public Broadphase
+	{
+	public:
+		typedef BVHNode<BoundingBox> Node;
+
+	protected:
+		//Root of the tree. NULL if the tree is empty
+		Node* root;
+
+		//Holds the margin leaves are enlarged by
+		real margin;
+
+		//Holds all the leaves, used to update them each frame
+		std::vector<Node*> leaves;
+
+		//Holds the index in leaves of each collider in the tree
+		std::unordered_map<CollisionPrimitive*, unsigned> leafIndex;
+
+		//Holds colliders without finite bounds
+		std::vector<CollisionPrimitive*> unbounded;
+
+	public:
+		AABBTreeBroadphase(real margin = DEFAULT_AABB_MARGIN) :root(NULL), margin(margin) {}
+
+		~AABBTreeBroadphase();
+
+		void add(CollisionPrimitive* collider);
+		void remove(CollisionPrimitive* collider);
+		void update();
+		void getPotentialContacts(std::vector<PotentialContact>& contacts);
+
+		/**
+		* Appends all colliders whose volume overlaps the given box to
+		* the list. Colliders without finite bounds are always appended.
+		*/
+		void query(const BoundingBox& box, std::vector<CollisionPrimitive*>& result) const;
+
+		//Gets the height of the tree. Used to check the tree is well balanced
+		int getHeight() const { return root ? root->height : 0; }
+	};
+
+	/**
+	* An incremental sweep and prune broad phase. The bounds of every
+	* collider are kept as sorted lists of end points along each world
+	* axis. Between frames the lists are re-sorted with insertion sort,
+	* which is close to linear when the colliders only move a little.
+	* Overlapping pairs are kept across frames and only changed when two
+	* end points swap, so the pairs that started or stopped overlapping
+	* can also be read back. The changes gather over updates, adds and
+	* removes until clearPairChanges is called.
+	*
+	* Colliders without finite bounds (planes) are paired with every
+	* other collider and are not part of the added and removed lists.
+	*/
+	class SweepAndPruneBroadphase : public Broadphase
+	{
+	protected:
+		//Holds the margin the bounds are enlarged by, so that resting
+		//colliders that just touch are always reported
+		real margin;
+
+		/**
+		* Holds the bounds of a single collider.
+		*/
+		struct Proxy
+		{
+			CollisionPrimitive* collider;
+			//The bounds are kept as min and max values, so the overlap test
+			//gives exactly the same answer as comparing the end points
+			Vector3 min;
+			Vector3 max;
+
+			//Holds the proxies this one overlaps
+			std::vector<unsigned> partners;
+
+			void setBounds(const BoundingBox& box)
 			{
-				return count + chidren[1]->getPotentialContactsWith(other, contacts+count, limit - count);
+				min = box.getMin();
+				max = box.getMax();
 			}
-			else
+
+			bool overlaps(const Proxy& other) const
 			{
-				return count;
+				return min.x <= other.max.x && other.min.x <= max.x &&
+					min.y <= other.max.y && other.min.y <= max.y &&
+					min.z <= other.max.z && other.min.z <= max.z;
 			}
+		};
+
+		/**
+		* Holds one end of a collider's bounds along an axis.
+		*/
+		struct EndPoint
+		{
+			real value;
+			unsigned proxy;
+			bool isMin;
+		};
+
+		//Holds the proxies. Removed proxies are reused through freeProxies
+		std::vector<Proxy> proxies;
+		std::vector<unsigned> freeProxies;
+
+		//Holds the proxy of each collider
+		std::unordered_map<CollisionPrimitive*, unsigned> proxyIndex;
+
+		//Holds the sorted end points along x, y and z
+		std::vector<EndPoint> endPoints[3];
+
+		//Holds the overlapping pairs, keyed by their proxy indices
+		std::unordered_set<unsigned long long> pairs;
+
+		//Holds the pairs that started and stopped overlapping since the changes were cleared
+		std::vector<PotentialContact> addedPairs;
+		std::vector<PotentialContact> removedPairs;
+
+		//Holds colliders without finite bounds
+		std::vector<CollisionPrimitive*> unbounded;
+
+		static unsigned long long pairKey(unsigned a, unsigned b)
+		{
+			return a < b ? ((unsigned long long)a << 32) | b : ((unsigned long long)b << 32) | a;
 		}
-		else 
+
+		void addPair(unsigned a, unsigned b);
+		void removePair(unsigned a, unsigned b);
+
+		//Drops a proxy from the partners of another
+		void removePartner(unsigned proxy, unsigned partner);
+
+		//Finds the end point of a proxy in the sorted list of an axis
+		unsigned findEndPoint(unsigned axis, unsigned proxy, bool isMin) const;
+
+		//Sorts the end points of an axis, updating the pairs as end points pass each other
+		void sortAxis(unsigned axis);
+
+	public:
+		SweepAndPruneBroadphase(real margin = DEFAULT_AABB_MARGIN) :margin(margin) {}
+
+		void add(CollisionPrimitive* collider);
+		void remove(CollisionPrimitive* collider);
+		void update();
+		void getPotentialContacts(std::vector<PotentialContact>& contacts);
+
+		//Gets the pairs that started overlapping since the changes were cleared
+		const std::vector<PotentialContact>& getAddedPairs() const { return addedPairs; }
+
+		/**
+		* Gets the pairs that stopped overlapping since the changes were
+		* cleared. A pair removed with one of its colliders still names
+		* that collider, so read them before it is destroyed.
+		*/
+		const std::vector<PotentialContact>& getRemovedPairs() const { return removedPairs; }
+
+		void clearPairChanges()
 		{
-			// Recurse into the other node
-			unsigned count = getPotentialContactsWith(other->chidren[0],contacts,limit);
+			addedPairs.clear();
+			removedPairs.clear();
+		}
+	};
 
-			if (limit > count)
-			{
-				return count + getPotentialContactsWith(other->chidren[1], contacts + count, limit - count);
-			}
-			else
+	/**
+	* Holds the occupancy of a spatial grid, to help choosing its cell size.
+	*/
+	struct GridStats
+	{
+		//Number of cells the world is divided into
+		unsigned long long cellCount;
+		//Number of cells holding at least one collider
+		unsigned occupiedCells;
+		//Number of (collider, cell) entries
+		unsigned entryCount;
+		//The largest number of colliders in a single cell
+		unsigned maxCollidersInCell;
+		//Number of colliders too large to be put in the grid
+		unsigned oversizedCount;
+		//Average number of colliders in an occupied cell
+		real averageCollidersInCell;
+	};
+
+	/**
+	* A uniform grid broad phase. The world, which spans from -worldSize
+	* to worldSize, is divided into cubic cells and each collider is put
+	* in every cell its bounds cover. Colliders outside the world are
+	* clamped to the border cells. Only the cells that hold colliders are
+	* stored: the entries are hashed into buckets with a counting sort
+	* each update, so finding the pairs is close to linear for scenes of
+	* similarly sized colliders.
+	*
+	* A pair sharing several cells is only reported in the first of them.
+	* Colliders covering more than maxCellsPerCollider cells are kept out
+	* of the grid and checked against every other collider instead.
+	*/
+	class SpatialGridBroadphase : public Broadphase
+	{
+	protected:
+		/**
+		* Holds the bounds of a collider and the range of cells they cover.
+		*/
+		struct Proxy
+		{
+			CollisionPrimitive* collider;
+			Vector3 min;
+			Vector3 max;
+			unsigned cellMin[3];
+			unsigned cellMax[3];
+			//True if the collider covers too many cells to be put in the grid
+			bool oversized;
+
+			bool overlaps(const Proxy& other) const
 			{
-				return count;
+				return min.x <= other.max.x && other.min.x <= max.x &&
+					min.y <= other.max.y && other.min.y <= max.y &&
+					min.z <= other.max.z && other.min.z <= max.z;
 			}
+		};
+
+		/**
+		* Holds a collider in one of its cells.
+		*/
+		struct Entry
+		{
+			unsigned proxy;
+			unsigned long long cell;
+		};
+
+		Vector3 worldSize;
+		real cellSize;
+		unsigned maxCellsPerCollider;
+
+		//Number of cells along each axis
+		unsigned gridSize[3];
+
+		//Holds the colliders with finite bounds
+		std::vector<CollisionPrimitive*> colliders;
+
+		//Holds colliders without finite bounds
+		std::vector<CollisionPrimitive*> unbounded;
+
+		//Holds the index of each collider in colliders, or in unbounded
+		std::unordered_map<CollisionPrimitive*, unsigned> colliderIndex;
+
+		//Holds the bounds of the colliders, rebuilt each update
+		std::vector<Proxy> proxies;
+
+		//Holds the proxies that are too large for the grid
+		std::vector<unsigned> oversized;
+
+		//Holds the entries sorted by bucket, and where each bucket starts
+		std::vector<Entry> entries;
+		std::vector<Entry> sortedEntries;
+		std::vector<unsigned> bucketStart;
+
+		GridStats stats;
+
+		//Gets the cell of a coordinate along an axis
+		unsigned getCell(real value, unsigned axis) const;
+
+		//Gets the key of a cell from its coordinates. Grids may have more cells than fit in 32 bits
+		unsigned long long getCellKey(unsigned x, unsigned y, unsigned z) const
+		{
+			return x + gridSize[0] * (y + (unsigned long long)gridSize[1] * z);
 		}
 
-	}
+		//Gets the bucket a cell is hashed to
+		static unsigned getBucket(unsigned long long cell, unsigned mask)
+		{
+			unsigned long long hash = cell * 0x9E3779B97F4A7C15ull;
+			return (unsigned)(hash >> 32) & mask;
+		}
+
+	public:
+		SpatialGridBroadphase(const Vector3& worldSize, real cellSize = DEFAULT_GRID_CELL_SIZE,
+			unsigned maxCellsPerCollider = DEFAULT_GRID_MAX_CELLS);
+
+		void add(CollisionPrimitive* collider);
+		void remove(CollisionPrimitive* collider);
+		void update();
+		void getPotentialContacts(std::vector<PotentialContact>& contacts);
+
+		/**
+		* Gets the occupancy of the grid. The numbers are gathered by
+		* getPotentialContacts, so they describe the last query.
+		*/
+		const GridStats& getStats() const { return stats; }
+
+		real getCellSize() const { return cellSize; }
+	};
 
 }
@@ -1,22 +1,73 @@
 #pragma once
 #include "contact.h"
-//Tags to mark different colliders
-#define BOX_TAG 1
-#define SPHERE_TAG 2
-#define PLANE_TAG 3
+//Tags to mark different colliders. A tag is the index of the collider's class in CollisionShapes
+#define BOX_TAG (crystal::ShapeIndex<crystal::CollisionBox, crystal::CollisionShapes>::value)
+#define SPHERE_TAG (crystal::ShapeIndex<crystal::CollisionSphere, crystal::CollisionShapes>::value)
+#define PLANE_TAG (crystal::ShapeIndex<crystal::CollisionPlane, crystal::CollisionShapes>::value)
+//Default collision filtering. Every collider is in the first category and collides with all categories
+#define DEFAULT_CATEGORY_BITS 0x0001
+#define DEFAULT_MASK_BITS 0xFFFFFFFF
+//The most contacts a collide function generates for a pair, for a box resting on a plane
+#define MAX_PAIR_CONTACTS 8
+//Marks a pair of boxes with no cached separating axis
+#define NO_SEPARATING_AXIS 0xffffffff
 
 namespace crystal {
 	// Forward declarations of primitive friends
 	class IntersectionTests;
 	class CollisionDetector;
 
+	class CollisionPrimitive;
+	class CollisionBox;
+	class CollisionSphere;
+	class CollisionPlane;
+
+	/**
+	* A list of primitive classes. The position of a class in the list
+	* is its shape type.
+	*/
+	template<class... Shapes>
+	struct ShapeList
+	{
+		static const unsigned size = sizeof...(Shapes);
+	};
+
+	/**
+	* Finds the position of a class in a shape list at compile time. A
+	* class missing from the list doesn't compile.
+	*/
+	template<class Shape, class List>
+	struct ShapeIndex;
+
+	template<class Shape, class... Rest>
+	struct ShapeIndex<Shape, ShapeList<Shape, Rest...> >
+	{
+		static const unsigned value = 0;
+	};
+
+	template<class Shape, class First, class... Rest>
+	struct ShapeIndex<Shape, ShapeList<First, Rest...> >
+	{
+		static const unsigned value = 1 + ShapeIndex<Shape, ShapeList<Rest...> >::value;
+	};
+
+	/**
+	* All the primitive classes the collision detector knows about. To
+	* add a new primitive, append it here, pass its ShapeIndex to the
+	* CollisionPrimitive constructor and specialise PairCollider for the
+	* pairs it can collide with.
+	*/
+	typedef ShapeList<CollisionPrimitive, CollisionBox, CollisionSphere, CollisionPlane> CollisionShapes;
+
 	/**
 	* Represents a primitive to detect collisions against.
 	*/
 	class CollisionPrimitive
 	{
 	public:
-		CollisionPrimitive():isActive(true)
+		CollisionPrimitive(unsigned shapeType = 0):isActive(true),
+			categoryBits(DEFAULT_CATEGORY_BITS), maskBits(DEFAULT_MASK_BITS), groupIndex(0),
+			shapeType(shapeType)
 		{
 			id = CollisionPrimitive::CurrentId++;
 		}
@@ -25,10 +76,52 @@ namespace crystal {
 
 		unsigned getId() { return id; }
 
+		//Gets the handle of the primitive in the world it was added to
+		ColliderHandle getHandle() const { return handle; }
+
 		//Only active primitive can generate contacts
 		bool isActive;
 
-		virtual int getTag() const{ return 0; };
+		/**
+		* The collision categories this primitive belongs to. Usually
+		* only one bit is set.
+		*/
+		unsigned categoryBits;
+
+		/**
+		* The categories this primitive collides with. Two primitives
+		* only collide if each one's category is in the other's mask.
+		*/
+		unsigned maskBits;
+
+		/**
+		* Overrides the category filtering. Primitives with the same
+		* positive group index always collide, primitives with the same
+		* negative group index never collide. Zero means no group.
+		*/
+		int groupIndex;
+
+		/**
+		* Checks the filter data of two primitives to see if they are
+		* allowed to collide. This is checked before any collision
+		* detection is done on the pair.
+		*/
+		static bool shouldCollide(const CollisionPrimitive& one, const CollisionPrimitive& two)
+		{
+			if (one.groupIndex != 0 && one.groupIndex == two.groupIndex)
+			{
+				return one.groupIndex > 0;
+			}
+			return (one.categoryBits & two.maskBits) != 0 && (two.categoryBits & one.maskBits) != 0;
+		}
+
+		virtual int getTag() const{ return shapeType; };
+
+		/**
+		* Gets the type of the primitive without a virtual call. This is
+		* the index of the primitive's class in CollisionShapes.
+		*/
+		unsigned getShapeType() const { return shapeType; }
 		/**
 		* This class exists to help the collision detector
 		* and intersection routines, so they should have
@@ -82,6 +175,17 @@ namespace crystal {
 		Matrix4 transform;
 
 		unsigned id;
+
+		//The handle of the primitive in its world, cleared when the world removes it
+		ColliderHandle handle;
+
+		//The handle of the primitive's collision callback in its world, if it has one
+		Handle callback;
+
+		friend class World;
+
+		//The type of the primitive, set by the constructor of each primitive class
+		unsigned shapeType;
 	private:
 		static unsigned CurrentId;
 	};
@@ -98,7 +202,7 @@ namespace crystal {
 		*/
 		real radius;
 
-		int getTag() const { return SPHERE_TAG; };
+		CollisionSphere() :CollisionPrimitive(SPHERE_TAG) {}
 	};
 
 	/**
@@ -121,7 +225,7 @@ namespace crystal {
 		*/
 		real offset;
 
-		int getTag() const { return PLANE_TAG; };
+		CollisionPlane() :CollisionPrimitive(PLANE_TAG) {}
 	};
 
 	/**
@@ -136,7 +240,7 @@ namespace crystal {
 		*/
 		Vector3 halfSize;
 
-		int getTag() const { return BOX_TAG; };
+		CollisionBox() :CollisionPrimitive(BOX_TAG) {}
 	};
 
 	/**
@@ -213,6 +317,22 @@ namespace crystal {
 		*/
 		real tolerance;
 
+		/**
+		* Holds the separating axis cached for the pair being checked,
+		* or NULL if the pair has no cache. Box-box tests try the
+		* cached axis first, and store the axis that separated the
+		* boxes, or NO_SEPARATING_AXIS if they overlap.
+		*/
+		unsigned *cachedAxis;
+
+		/** Counts the pairs rejected by their cached separating axis. */
+		unsigned axisCacheHits;
+
+		/** Counts the pairs whose cached separating axis no longer separates them. */
+		unsigned axisCacheMisses;
+
+		CollisionData() :cachedAxis(NULL), axisCacheHits(0), axisCacheMisses(0) {}
+
 		/**
 		* Checks if there are more contacts available in the contact
 		* data.
@@ -230,6 +350,8 @@ namespace crystal {
 			contactsLeft = maxContacts;
 			contactCount = 0;
 			contacts = contactArray;
+			axisCacheHits = 0;
+			axisCacheMisses = 0;
 		}
 
 		/**
@@ -258,6 +380,30 @@ namespace crystal {
 	class CollisionDetector
 	{
 	public:
+		/**
+		* Selects the SSE separating axis kernel for box-box tests when
+		* the engine is built with CRYSTAL_USE_SSE. Set it to false to
+		* run the scalar path instead. Defaults to true.
+		*/
+		static bool useSSE;
+
+		/**
+		* Finds the axis of least penetration between two boxes with the
+		* kernel useSSE selects, as boxAndBox does. Axes 0 to 2 are the
+		* faces of box one, 3 to 5 the faces of box two and 6 to 14 the
+		* pairs of their edges. singleAxis is the face axis with the least
+		* penetration. Returns false if the boxes are separated, with axis
+		* set to the axis that separates them. Used to check the kernels
+		* against each other.
+		*/
+		static bool boxAndBoxAxis(
+			const CollisionBox &one,
+			const CollisionBox &two,
+			real &penetration,
+			unsigned &axis,
+			unsigned &singleAxis
+		);
+
 		//Check two primitive types.
 		//Call the right methods according to the params' tags
 		static unsigned primitiveCollide(
@@ -311,4 +457,143 @@ namespace crystal {
 			CollisionData *data
 		);
 	};
-}
\ No newline at end of file
+
+	/**
+	* The signature of a function generating the contacts of a pair of
+	* primitives.
+	*/
+	typedef unsigned(*CollideFunction)(const CollisionPrimitive& one,
+		const CollisionPrimitive& two, CollisionData *data);
+
+	/**
+	* Generates the contacts between two primitive classes. Pairs without
+	* a specialisation never collide.
+	*/
+	template<class One, class Two>
+	struct PairCollider
+	{
+		static unsigned collide(const CollisionPrimitive&, const CollisionPrimitive&, CollisionData*)
+		{
+			return 0;
+		}
+	};
+
+	template<>
+	struct PairCollider<CollisionBox, CollisionBox>
+	{
+		static unsigned collide(const CollisionPrimitive& one, const CollisionPrimitive& two, CollisionData *data)
+		{
+			return CollisionDetector::boxAndBox((const CollisionBox&)one, (const CollisionBox&)two, data);
+		}
+	};
+
+	template<>
+	struct PairCollider<CollisionBox, CollisionSphere>
+	{
+		static unsigned collide(const CollisionPrimitive& one, const CollisionPrimitive& two, CollisionData *data)
+		{
+			return CollisionDetector::boxAndSphere((const CollisionBox&)one, (const CollisionSphere&)two, data);
+		}
+	};
+
+	template<>
+	struct PairCollider<CollisionSphere, CollisionBox>
+	{
+		static unsigned collide(const CollisionPrimitive& one, const CollisionPrimitive& two, CollisionData *data)
+		{
+			return CollisionDetector::boxAndSphere((const CollisionBox&)two, (const CollisionSphere&)one, data);
+		}
+	};
+
+	template<>
+	struct PairCollider<CollisionBox, CollisionPlane>
+	{
+		static unsigned collide(const CollisionPrimitive& one, const CollisionPrimitive& two, CollisionData *data)
+		{
+			return CollisionDetector::boxAndHalfSpace((const CollisionBox&)one, (const CollisionPlane&)two, data);
+		}
+	};
+
+	template<>
+	struct PairCollider<CollisionPlane, CollisionBox>
+	{
+		static unsigned collide(const CollisionPrimitive& one, const CollisionPrimitive& two, CollisionData *data)
+		{
+			return CollisionDetector::boxAndHalfSpace((const CollisionBox&)two, (const CollisionPlane&)one, data);
+		}
+	};
+
+	template<>
+	struct PairCollider<CollisionSphere, CollisionSphere>
+	{
+		static unsigned collide(const CollisionPrimitive& one, const CollisionPrimitive& two, CollisionData *data)
+		{
+			return CollisionDetector::sphereAndSphere((const CollisionSphere&)two, (const CollisionSphere&)one, data);
+		}
+	};
+
+	template<>
+	struct PairCollider<CollisionSphere, CollisionPlane>
+	{
+		static unsigned collide(const CollisionPrimitive& one, const CollisionPrimitive& two, CollisionData *data)
+		{
+			return CollisionDetector::sphereAndHalfSpace((const CollisionSphere&)one, (const CollisionPlane&)two, data);
+		}
+	};
+
+	template<>
+	struct PairCollider<CollisionPlane, CollisionSphere>
+	{
+		static unsigned collide(const CollisionPrimitive& one, const CollisionPrimitive& two, CollisionData *data)
+		{
+			return CollisionDetector::sphereAndHalfSpace((const CollisionSphere&)two, (const CollisionPlane&)one, data);
+		}
+	};
+
+	/**
+	* Holds one row of the dispatch table: the functions colliding the
+	* class One with every class of the list.
+	*/
+	template<class One, class List>
+	struct DispatchRow;
+
+	template<class One, class... Shapes>
+	struct DispatchRow<One, ShapeList<Shapes...> >
+	{
+		static const CollideFunction functions[sizeof...(Shapes)];
+	};
+
+	template<class One, class... Shapes>
+	const CollideFunction DispatchRow<One, ShapeList<Shapes...> >::functions[sizeof...(Shapes)] =
+	{ &PairCollider<One, Shapes>::collide... };
+
+	/**
+	* A table of collide functions indexed by the shape types of the two
+	* primitives. The table is built from the shape list at compile time.
+	*/
+	template<class List>
+	struct DispatchTable;
+
+	template<class... Shapes>
+	struct DispatchTable<ShapeList<Shapes...> >
+	{
+		static const unsigned size = sizeof...(Shapes);
+		static const CollideFunction* const rows[sizeof...(Shapes)];
+
+		/**
+		* Gets the function colliding the given shape types. Unknown
+		* shape types get a function generating no contacts.
+		*/
+		static CollideFunction getFunction(unsigned one, unsigned two)
+		{
+			if (one >= size || two >= size) return rows[0][0];
+			return rows[one][two];
+		}
+	};
+
+	template<class... Shapes>
+	const CollideFunction* const DispatchTable<ShapeList<Shapes...> >::rows[sizeof...(Shapes)] =
+	{ DispatchRow<Shapes, ShapeList<Shapes...> >::functions... };
+
+	typedef DispatchTable<CollisionShapes> CollisionDispatcher;
+}
@@ -1,6 +1,23 @@
 #pragma once
 
 #include "body.h"
+#include "contact_batch.h"
+#include <vector>
+
+//The largest number of points a contact manifold can hold
+#define MAX_MANIFOLD_POINTS 4
+//Cached contact points further than this from a new contact, or that drifted this far, are dropped
+#define DEFAULT_CONTACT_BREAKING_THRESHOLD 0.02f
+//The fraction of the last frame's impulse applied to a contact before velocity resolution
+#define DEFAULT_WARM_START_FACTOR 0.8f
+//Marks a contact side with no body the resolver can move
+#define NO_CONTACT_BODY 0xffffffff
+//The default number of velocity sweeps of the sequential impulse mode
+#define DEFAULT_RESOLVER_SWEEPS 10
+//The fraction of the penetration beyond the slop the split impulse stage removes each frame
+#define DEFAULT_SPLIT_IMPULSE_FACTOR 0.4f
+//The number of worst first iterations between checks of the resolver's time budget
+#define RESOLVER_CLOCK_INTERVAL 32
 
 namespace crystal {
 
@@ -10,6 +27,28 @@ namespace crystal {
 	*/
 	class ContactResolver;
 
+	/**
+	* The ways a contact resolver can resolve velocities.
+	*/
+	enum ResolverMode
+	{
+		//Resolve the contact with the worst closing velocity first, one at a time
+		RESOLVER_WORST_FIRST,
+		//Sweep over all the contacts a fixed number of times, clamping the accumulated impulses
+		RESOLVER_SEQUENTIAL_IMPULSE
+	};
+
+	/**
+	* The ways a contact resolver can remove penetration.
+	*/
+	enum PositionMode
+	{
+		//Move the bodies of the deepest contact apart first, one contact at a time
+		POSITION_PROJECTION,
+		//Sweep over all the contacts solving pseudo velocities, then move each body once
+		POSITION_SPLIT_IMPULSE
+	};
+
 	/**
 	* A contact represents two bodies in contact. Resolving a
 	* contact removes their interpenetration, and applies sufficient
@@ -39,6 +78,9 @@ namespace crystal {
 		*/
 		friend class ContactResolver;
 
+		//The batch solver packs the contact data of the sequential impulse mode
+		friend class ContactBatchSolver;
+
 	public:
 		/**
 		* Holds the bodies that are involved in the contact. The
@@ -73,9 +115,19 @@ namespace crystal {
 		*/
 		real penetration;
 
+		/**
+		* Holds the total impulse applied at the contact, in contact
+		* coordinates (x along the normal, y and z along the contact
+		* plane). Before resolution it holds the impulse carried over
+		* from the previous frame, which is used to warm start the
+		* resolver.
+		*/
+		Vector3 accumulatedImpulse;
+
 		/**
 		* Sets the data that doesn't normally depend on the position
 		* of the contact (i.e. the bodies, and their material properties).
+		* This also clears the accumulated impulse.
 		*/
 		void setBodyData(RigidBody* one, RigidBody *two,
 			real friction, real restitution);
@@ -164,6 +216,13 @@ namespace crystal {
 		void applyVelocityChange(Vector3 velocityChange[2],
 			Vector3 rotationChange[2]);
 
+		/**
+		* Applies the given impulse, in contact coordinates, to both
+		* bodies of the contact, returning the change in velocities.
+		*/
+		void applyContactImpulse(const Vector3 &impulseContact,
+			Vector3 velocityChange[2], Vector3 rotationChange[2]);
+
 		/**
 		* Performs an inertia weighted penetration resolution of this
 		* contact alone.
@@ -189,6 +248,76 @@ namespace crystal {
 		* function has access to these anyway.
 		*/
 		Vector3 calculateFrictionImpulse(Matrix3 *inverseInertiaTensor);
+
+		/**
+		* Calculates the matrix converting an impulse in contact
+		* coordinates into the change in closing velocity it makes, in
+		* contact coordinates.
+		*/
+		Matrix3 calculateDeltaVelocityMatrix(Matrix3 *inverseInertiaTensor);
+	};
+
+	/**
+	* An indexed binary max-heap of contact severities, used by the
+	* resolver to pick the worst contact. Contacts are ordered by their
+	* severity, and equal severities by their index, so the top is the
+	* same contact a linear scan for the first largest value finds. The
+	* severity of any contact can be changed in place.
+	*/
+	class ContactHeap
+	{
+	protected:
+		//Holds the severity of each contact
+		std::vector<real> severity;
+
+		//Holds the contacts in heap order
+		std::vector<unsigned> heap;
+
+		//Holds the place of each contact in the heap
+		std::vector<unsigned> place;
+
+		//Checks if contact one should be above contact two
+		bool isAbove(unsigned one, unsigned two) const
+		{
+			return severity[one] > severity[two] ||
+				(severity[one] == severity[two] && one < two);
+		}
+
+		//Moves the contact at the given place up or down until the heap is ordered
+		void siftUp(unsigned index);
+		void siftDown(unsigned index);
+
+	public:
+		/**
+		* Starts a heap of the given number of contacts. Set the
+		* severity of each contact with setSeverity, then call build.
+		*/
+		void reset(unsigned count)
+		{
+			severity.resize(count);
+		}
+
+		void setSeverity(unsigned contact, real value)
+		{
+			severity[contact] = value;
+		}
+
+		//Orders the contacts by the severities set since the last reset
+		void build();
+
+		//Gets the contact with the highest severity. The heap must not be empty
+		unsigned top() const
+		{
+			return heap[0];
+		}
+
+		real getSeverity(unsigned contact) const
+		{
+			return severity[contact];
+		}
+
+		//Changes the severity of a contact, keeping the heap ordered
+		void update(unsigned contact, real value);
 	};
 
 	/**
@@ -238,6 +367,38 @@ namespace crystal {
 	* In general this resolver is not suitable for stacks of bodies,
 	* but is perfect for handling impact, explosive, and flat resting
 	* situations.
+	*
+	* @subsection modes Sequential Impulse Mode
+	*
+	* For stacks the resolver can instead resolve velocities with a
+	* fixed number of sweeps over all the contacts (projected
+	* Gauss-Seidel). Each contact keeps the total impulse it applied,
+	* clamped so it only pushes and its friction stays inside the
+	* friction pyramid. The cost is the number of contacts times the
+	* number of sweeps, whatever the scene. Penetration is still
+	* resolved worst first.
+	*
+	* @subsection split Split Impulse Position Stage
+	*
+	* Projection moves the bodies of one contact at a time, and the
+	* move of one contact shows up as motion to the next frame, which
+	* makes stacks jitter. The split impulse stage instead solves pseudo
+	* velocities for all the contacts at once, in the same batches as
+	* the sequential impulse mode, and moves each body once at the end.
+	* The pseudo velocities are thrown away after the move, so pushing
+	* the contacts apart never adds to the real velocities.
+	*
+	* @subsection budget Convergence and Time Budget
+	*
+	* Each stage stops as soon as nothing is left above its epsilon,
+	* so the iteration counts are only upper bounds. The sweeps stop
+	* once a sweep finds no contact further than the velocity epsilon
+	* from its target velocity. The resolver can also be given a time
+	* budget: the position stage may take half of it, and the velocity
+	* stage stops at the end of it. A stage that runs out of time leaves
+	* its worst contacts partly resolved, and the next frame picks them
+	* up again. After each call the resolver reports the iterations
+	* used, what was left unresolved and whether the budget ran out.
 	*/
 	class ContactResolver
 	{
@@ -272,6 +433,58 @@ namespace crystal {
 		*/
 		real positionEpsilon;
 
+		/**
+		* Holds the fraction of each contact's accumulated impulse that
+		* is applied before the velocity iterations. Zero disables warm
+		* starting.
+		*/
+		real warmStartFactor;
+
+		//Holds how the velocities are resolved
+		ResolverMode mode;
+
+		//Holds the number of sweeps over all contacts in the sequential impulse mode
+		unsigned sweeps;
+
+		//Holds how the penetration is removed
+		PositionMode positionMode;
+
+		//Holds the fraction of the penetration beyond the epsilon the split impulse stage removes
+		real splitImpulseFactor;
+
+		//Holds the most microseconds a call to resolve contacts may take, zero for no limit
+		unsigned timeBudget;
+
+		//Holds when each stage of the current call runs out of time
+		SolverClock::time_point positionDeadline;
+		SolverClock::time_point velocityDeadline;
+
+		/**
+		* Holds the contacts of each body, grouped by body, as the
+		* contact index times two plus the body's side in the contact.
+		* Only bodies with finite mass have contacts listed, since the
+		* resolver never changes the others.
+		*/
+		std::vector<unsigned> bodyContacts;
+
+		//Holds where the contacts of each body start in bodyContacts, and where the last ends
+		std::vector<unsigned> bodyContactStart;
+
+		//Holds the body index of both sides of each contact, or NO_CONTACT_BODY
+		std::vector<unsigned> contactBodies;
+
+		//Holds the index of each body while the lists are built
+		BodyIndex bodyIndex;
+
+		//Orders the contacts by severity in each resolution stage
+		ContactHeap severityHeap;
+
+		//Solves the velocities in the sequential impulse mode
+		ContactBatchSolver batchSolver;
+
+		//Holds the workers sharing out the colors of the sweeps, or NULL
+		WorkerPool* workers;
+
 	public:
 		/**
 		* Stores the number of velocity iterations used in the
@@ -285,6 +498,23 @@ namespace crystal {
 		*/
 		unsigned positionIterationsUsed;
 
+		/**
+		* Stores the largest velocity change left to make at any contact
+		* after the last call to resolve contacts. In the sequential
+		* impulse mode this is the largest error found by the last sweep.
+		*/
+		real velocityResidual;
+
+		/**
+		* Stores the deepest penetration left after the last call to
+		* resolve contacts. For the split impulse stage this is the
+		* largest distance its last sweep still had left to push.
+		*/
+		real positionResidual;
+
+		//Stores whether the last call to resolve contacts ran out of time
+		bool budgetExceeded;
+
 	private:
 		/**
 		* Keeps track of whether the internal settings are valid.
@@ -337,6 +567,90 @@ namespace crystal {
 		void setEpsilon(real velocityEpsilon,
 			real positionEpsilon);
 
+		/**
+		* Sets the fraction of the impulse carried over from the last
+		* frame that is applied to each contact before resolving
+		* velocities. Use zero to disable warm starting.
+		*/
+		void setWarmStartFactor(real factor)
+		{
+			warmStartFactor = factor;
+		}
+
+		/**
+		* Sets how the velocities are resolved. The sequential impulse
+		* mode makes the given number of sweeps over all the contacts,
+		* whatever the number of iterations.
+		*/
+		void setMode(ResolverMode mode, unsigned sweeps = DEFAULT_RESOLVER_SWEEPS)
+		{
+			ContactResolver::mode = mode;
+			ContactResolver::sweeps = sweeps;
+		}
+
+		ResolverMode getMode() const
+		{
+			return mode;
+		}
+
+		/**
+		* Sets how the penetration is removed. The split impulse stage
+		* removes the given fraction of each contact's penetration
+		* beyond the position epsilon in each call, with up to as many
+		* sweeps as the sequential impulse mode. Its sweeps stop once no
+		* pseudo velocity is further than the velocity epsilon from its
+		* target.
+		*/
+		void setPositionMode(PositionMode mode, real factor = DEFAULT_SPLIT_IMPULSE_FACTOR)
+		{
+			positionMode = mode;
+			splitImpulseFactor = factor;
+		}
+
+		PositionMode getPositionMode() const
+		{
+			return positionMode;
+		}
+
+		/**
+		* Sets the most time in microseconds each call to resolve
+		* contacts may take, or zero for no limit. The clock is only
+		* checked every few iterations, so a call may run a little over.
+		*/
+		void setTimeBudget(unsigned microseconds)
+		{
+			timeBudget = microseconds;
+		}
+
+		unsigned getTimeBudget() const
+		{
+			return timeBudget;
+		}
+
+		/**
+		* Sets the workers the sequential impulse sweeps share each
+		* color out between, or NULL to sweep on the calling thread.
+		* The resolver must not be running on one of the workers.
+		*/
+		void setWorkers(WorkerPool* workers)
+		{
+			ContactResolver::workers = workers;
+		}
+
+		/**
+		* Takes the epsilon values, the warm start factor, the modes and
+		* the time budget of another resolver, keeping this resolver's
+		* buffers.
+		*/
+		void copySettings(const ContactResolver& other)
+		{
+			setEpsilon(other.velocityEpsilon, other.positionEpsilon);
+			setWarmStartFactor(other.warmStartFactor);
+			setMode(other.mode, other.sweeps);
+			setPositionMode(other.positionMode, other.splitImpulseFactor);
+			setTimeBudget(other.timeBudget);
+		}
+
 		/**
 		* Resolves a set of contacts for both penetration and velocity.
 		*
@@ -371,11 +685,21 @@ namespace crystal {
 		/**
 		* Sets up contacts ready for processing. This makes sure their
 		* internal data is configured correctly and the correct set of bodies
-		* is made alive.
+		* is made alive. It also lists the contacts of each body, so
+		* resolving a contact only updates the contacts sharing a body
+		* with it.
 		*/
 		void prepareContacts(Contact *contactArray, unsigned numContacts,
 			real duration);
 
+		/**
+		* Applies the impulses carried over from the last frame, scaled
+		* by the warm start factor, and updates the contact velocities.
+		*/
+		void warmStart(Contact *contactArray,
+			unsigned numContacts,
+			real duration);
+
 		/**
 		* Resolves the velocity issues with the given array of constraints,
 		* using the given number of iterations.
@@ -384,6 +708,17 @@ namespace crystal {
 			unsigned numContacts,
 			real duration);
 
+		/**
+		* Resolves the velocities of the given contacts with a fixed
+		* number of sweeps over all of them, in the batches of contacts
+		* that share no body. The batches must have been built. Each contact's accumulated impulse is kept
+		* pushing and its friction inside the friction pyramid, so a
+		* contact can take back impulse it gave earlier.
+		*/
+		void sweepVelocities(Contact *contactArray,
+			unsigned numContacts,
+			real duration);
+
 		/**
 		* Resolves the positional issues with the given array of constraints,
 		* using the given number of iterations.
@@ -391,6 +726,13 @@ namespace crystal {
 		void adjustPositions(Contact *contacts,
 			unsigned numContacts,
 			real duration);
+
+		/**
+		* Resolves the positional issues with the split impulse stage,
+		* in the batches of contacts that share no body. The batches
+		* must have been built.
+		*/
+		void pushPositions(real duration);
 	};
 
 	/**
@@ -411,4 +753,72 @@ namespace crystal {
 		virtual unsigned addContact(Contact *contact, unsigned limit) const = 0;
 	};
 
-}
\ No newline at end of file
+	/**
+	* A point of a contact manifold. The point is stored in the local
+	* space of both bodies, so that it can follow them between frames.
+	*/
+	struct ManifoldPoint
+	{
+		//The contact point in the local space of each body. For contacts
+		//with the scenery the second point is in world space.
+		Vector3 localPoint[2];
+
+		//The contact normal and penetration when the point was created
+		Vector3 normal;
+		real penetration;
+
+		//The current world position and penetration of the point
+		Vector3 position;
+		real currentPenetration;
+
+		//The impulse applied at the point in the last frame
+		Vector3 accumulatedImpulse;
+	};
+
+	/**
+	* Holds up to MAX_MANIFOLD_POINTS contact points between two
+	* colliders, kept across frames. Contacts found by the collision
+	* detector are merged into the manifold: a new contact close to a
+	* cached point replaces it but keeps its accumulated impulse, so the
+	* resolver can be warm started. Cached points are dropped once the
+	* bodies separate or slide apart.
+	*/
+	class ContactManifold
+	{
+	public:
+		RigidBody* body[2];
+		ManifoldPoint points[MAX_MANIFOLD_POINTS];
+		unsigned pointCount;
+
+		ContactManifold() :pointCount(0)
+		{
+			body[0] = body[1] = NULL;
+		}
+
+		/**
+		* Updates the cached points to the current position of the
+		* bodies, dropping the points that broke.
+		*/
+		void refresh(real breakingThreshold = DEFAULT_CONTACT_BREAKING_THRESHOLD);
+
+		/**
+		* Merges a new contact into the manifold. If the manifold is full
+		* the point that keeps the largest contact area is replaced.
+		*/
+		void addContact(const Contact& contact, real breakingThreshold = DEFAULT_CONTACT_BREAKING_THRESHOLD);
+
+		/**
+		* Writes the points of the manifold as contacts, at most limit of
+		* them. The pointer to the point of each written contact is stored
+		* in the given array, so the impulses can be stored back after
+		* resolution. Returns the number of written contacts.
+		*/
+		unsigned writeContacts(Contact* contacts, unsigned limit, real friction, real restitution,
+			ManifoldPoint** writtenPoints);
+
+	protected:
+		//Finds the index of the point to replace with the given one when full
+		unsigned getReplacedPoint(const ManifoldPoint& point) const;
+	};
+
+}
@@ -0,0 +1,241 @@
+#pragma once
+#include "body.h"
+#include "workers.h"
+#include <vector>
+#include <chrono>
+
+//The number of contacts solved together in a batch, one per SIMD lane
+#define CONTACT_BATCH_LANES 4
+//Marks a batch lane with no contact
+#define NO_BATCH_CONTACT 0xffffffff
+//The number of batches of a color solved by each worker task
+#define CONTACT_BATCHES_PER_TASK 16
+
+namespace crystal {
+
+	class Contact;
+
+	//The clock the resolver checks its time budget against
+	typedef std::chrono::steady_clock SolverClock;
+
+	/**
+	* Holds the constraints of up to CONTACT_BATCH_LANES contacts in
+	* structure-of-arrays form, so each value can be loaded for all the
+	* lanes at once. The three constraint axes of a contact are its
+	* normal and its two tangents. No two lanes share a body the resolver
+	* can move, so the lanes can be solved side by side.
+	*/
+	struct ContactBatch
+	{
+		//Index of each lane's contact in the contact array, or NO_BATCH_CONTACT
+		unsigned contact[CONTACT_BATCH_LANES];
+
+		//Index of each lane's bodies in the velocity array
+		unsigned body[2][CONTACT_BATCH_LANES];
+
+		//The constraint axes in world space, by axis, component and lane
+		real axis[3][3][CONTACT_BATCH_LANES];
+
+		//The relative contact position of each body crossed with each axis
+		real torqueAxis[2][3][3][CONTACT_BATCH_LANES];
+
+		//The change in rotation of each body for a unit impulse along each axis
+		real rotationPerImpulse[2][3][3][CONTACT_BATCH_LANES];
+
+		real inverseMass[2][CONTACT_BATCH_LANES];
+
+		//The impulse needed per unit change in velocity along each axis
+		real impulsePerVelocity[3][CONTACT_BATCH_LANES];
+
+		//The total impulse applied along each axis
+		real impulse[3][CONTACT_BATCH_LANES];
+
+		//The normal velocity each contact should end with, after any bounce
+		real targetVelocity[CONTACT_BATCH_LANES];
+
+		real friction[CONTACT_BATCH_LANES];
+
+		//The penetration of each contact when the batch was built
+		real penetration[CONTACT_BATCH_LANES];
+
+		//The normal pseudo velocity each contact should end with, to push it out
+		real pushVelocity[CONTACT_BATCH_LANES];
+
+		//The total pseudo impulse applied along the normal
+		real pushImpulse[CONTACT_BATCH_LANES];
+	};
+
+	/**
+	* Solves the velocities of a set of contacts in batches, for the
+	* sequential impulse mode of the contact resolver. The velocities of
+	* the bodies are copied into a dense array for the sweeps and copied
+	* back at the end, so the sweeps never touch the contacts or the
+	* bodies. Bodies the resolver can't move all share one slot with no
+	* velocity and no inverse mass.
+	*
+	* The contacts are colored so no two contacts of a color share a
+	* body that can move, then each color is packed into batches. The
+	* batches of a color can be solved in any order, so a color can be
+	* shared out between workers, and the result doesn't depend on the
+	* number of workers. Bodies that can't move never take a color, so
+	* the ground doesn't force its contacts apart.
+	*
+	* The same batches can also push the contacts apart for the split
+	* impulse position stage. Each body is given a pseudo velocity,
+	* which only moves it within the frame and never adds to its real
+	* velocity, and the bodies are moved by their pseudo velocities once
+	* all the sweeps are done.
+	*/
+	class ContactBatchSolver
+	{
+	protected:
+		//Holds the velocity and rotation of a body during the sweeps
+		struct BodyVelocity
+		{
+			Vector3 velocity;
+			Vector3 rotation;
+		};
+
+		std::vector<ContactBatch> batches;
+
+		//Holds the bodies the resolver can move, by their index in the resolver
+		std::vector<RigidBody*> bodies;
+
+		//Holds the velocities of the bodies, followed by the slot of the others
+		std::vector<BodyVelocity> velocities;
+
+		//Holds the pseudo velocities of the bodies in the same way
+		std::vector<BodyVelocity> pushVelocities;
+
+		//Holds the colors used by each body, as colorWords words of bits
+		std::vector<unsigned long long> bodyColors;
+		unsigned colorWords;
+
+		//Holds the color of each contact while the batches are built
+		std::vector<unsigned> contactColor;
+
+		//Holds where the batches of each color start, and where the last ends
+		std::vector<unsigned> colorStart;
+
+		//Holds the next lane to fill in each color while the batches are built
+		std::vector<unsigned> colorCursor;
+
+		//Holds the tasks of the color being shared out between the workers
+		std::vector<unsigned> colorTasks;
+
+		//Holds the largest velocity error each worker found in the current sweep
+		std::vector<real> workerResidual;
+
+		//Holds the largest velocity error found in the last sweep
+		real residual;
+
+		//True if the last call to solve stopped at its deadline
+		bool timedOut;
+
+		//Finds the first color used by neither body and marks it used by both
+		unsigned takeColor(unsigned one, unsigned two, unsigned bodyCount);
+
+		//Fills the constraint data of a lane from its contact
+		void setLane(ContactBatch& batch, unsigned lane, const Contact& contact);
+
+		/**
+		* Makes a sweep over one batch, one lane at a time. Returns the
+		* largest normal velocity error the batch found before solving:
+		* how far each contact was from its target velocity, or how fast
+		* it was closing when it had no impulse left to take back.
+		*/
+		real solveBatch(ContactBatch& batch);
+
+		//Makes a sweep over one batch, with all the lanes at once
+		real solveBatchSSE(ContactBatch& batch);
+
+		/**
+		* Makes a sweep over the pseudo velocities of one batch. Only the
+		* normals are solved, so there is no friction. Returns the
+		* largest normal pseudo velocity error.
+		*/
+		real solvePushBatch(ContactBatch& batch);
+
+		//Makes a sweep over the batches in the given range, returning the largest error
+		real solveBatches(unsigned first, unsigned last, bool push);
+
+		//Makes a sweep over all the colors in turn, returning the largest error
+		real sweepColors(bool push, WorkerPool* workers);
+
+	public:
+		ContactBatchSolver() :colorWords(1), colorStart(1, 0), residual(0), timedOut(false) {}
+
+		/**
+		* Solves the batches with SSE when the target supports it.
+		* The lane at a time version gives the same result and is
+		* kept for checking.
+		*/
+		static bool useSSE;
+
+		/**
+		* Puts the given contacts into batches. Each contact takes the
+		* first color used by neither of its bodies, and the colors are
+		* packed in turn, keeping the order of their contacts. The
+		* contact bodies are given as the resolver's body index of each
+		* side of each contact, or NO_CONTACT_BODY.
+		*
+		* This must be called before warm starting, as the target
+		* velocities are taken from the velocities the contacts closed
+		* with.
+		*/
+		void build(Contact *contacts, unsigned numContacts,
+			const std::vector<unsigned>& contactBodies, unsigned bodyCount);
+
+		/**
+		* Makes up to the given number of sweeps over the batches,
+		* starting from the accumulated impulse of each contact. The
+		* sweeps stop early once a sweep finds no velocity error above
+		* the tolerance, or once the deadline has passed; at least one
+		* sweep is always made. The resulting velocities are written to
+		* the bodies, and the total impulses to the contacts. If workers
+		* are given, colors with enough batches are shared out between
+		* them. Returns the number of sweeps made.
+		*/
+		unsigned solve(Contact *contacts, unsigned sweeps, real tolerance,
+			SolverClock::time_point deadline, WorkerPool* workers = NULL);
+
+		/**
+		* Pushes the contacts apart with pseudo velocities, making up to
+		* the given number of sweeps. Each contact is given the pseudo
+		* velocity that removes the given fraction of its penetration
+		* beyond the slop in the given duration. The sweeps stop early
+		* once no contact is further than the tolerance from its target
+		* pseudo velocity, or once the deadline has passed. The bodies are then moved and have
+		* their derived data calculated, once each. Their velocities are
+		* not changed. Returns the number of sweeps made.
+		*/
+		unsigned solvePositions(real duration, real factor, real slop, real tolerance,
+			unsigned sweeps, SolverClock::time_point deadline, WorkerPool* workers = NULL);
+
+		/**
+		* Gets the largest error found in the last sweep of the last
+		* solve. After solving positions it is given as the distance
+		* left to push in the duration.
+		*/
+		real getResidual() const
+		{
+			return residual;
+		}
+
+		//Checks if the last solve or solvePositions stopped at its deadline
+		bool hasTimedOut() const
+		{
+			return timedOut;
+		}
+
+		unsigned getBatchCount() const
+		{
+			return batches.size();
+		}
+
+		unsigned getColorCount() const
+		{
+			return colorStart.size() - 1;
+		}
+	};
+}
@@ -10,14 +10,26 @@
 
 #include "body.h"
 
+#include "body_store.h"
+
+#include "slot_map.h"
+
 #include "pcontacts.h"
 
 #include "pworld.h"
 
 #include "collide_fine.h" // **
 
+#include "collide_coarse.h"
+
 #include "contact.h" // ** 
 
+#include "contact_batch.h"
+
+#include "island.h"
+
+#include "workers.h"
+
 #include "fgen.h"
 
 #include "world.h"
@@ -0,0 +1,83 @@
+#pragma once
+#include "contact.h"
+#include <vector>
+
+namespace crystal {
+
+	/**
+	* A set of contacts linked by the bodies they share. No body that
+	* can move is shared between two islands, so each island can be
+	* passed to the contact resolver on its own.
+	*/
+	struct ContactIsland
+	{
+		//Index of the island's first contact in the contact order
+		unsigned firstContact;
+
+		//Number of contacts in the island
+		unsigned contactCount;
+	};
+
+	/**
+	* Splits the contacts of a frame into islands with a union-find
+	* over the contacts: two contacts are in the same island if they
+	* share a body with finite mass. Bodies with infinite mass (and the
+	* scenery) never link contacts, since the resolver doesn't move them.
+	* Contacts between two bodies that can't move are left out of every
+	* island, as there is nothing to resolve.
+	*/
+	class IslandBuilder
+	{
+	protected:
+		//Holds the parent of each contact in the union-find
+		std::vector<unsigned> parent;
+
+		//Holds the last contact found touching each body
+		BodyIndex bodyContact;
+
+		//Holds the island of each union-find root
+		std::vector<unsigned> rootIsland;
+
+		std::vector<ContactIsland> islands;
+
+		std::vector<unsigned> contactOrder;
+
+		//Finds the root of a contact, halving the path on the way
+		unsigned find(unsigned contact);
+
+		//Merges the islands of two contacts. The smaller index becomes the root
+		void unite(unsigned one, unsigned two);
+
+		//Checks if the resolver can move the given body
+		static bool isDynamic(const RigidBody* body)
+		{
+			return body && body->hasFiniteMass();
+		}
+
+	public:
+		/**
+		* Builds the islands of the given contacts. Islands are ordered
+		* by their first contact, and keep the order of their contacts.
+		*/
+		void build(Contact* contacts, unsigned contactCount);
+
+		unsigned getIslandCount() const
+		{
+			return islands.size();
+		}
+
+		const ContactIsland& getIsland(unsigned index) const
+		{
+			return islands[index];
+		}
+
+		/**
+		* Gets the indices of the contacts in the contact array, grouped
+		* by island. Contacts left out of every island are not included.
+		*/
+		const std::vector<unsigned>& getContactOrder() const
+		{
+			return contactOrder;
+		}
+	};
+}
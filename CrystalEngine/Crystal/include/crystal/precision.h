@@ -2,6 +2,15 @@
 #include <math.h>
 #include <float.h>
 #include <string>
+
+/**
+* Enables the SSE kernels when the target supports SSE2. Define
+* CRYSTAL_NO_SSE to build the scalar paths only.
+*/
+#if !defined(CRYSTAL_NO_SSE) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__))
+#define CRYSTAL_USE_SSE
+#endif
+
 namespace crystal {
 
 	/**
@@ -22,6 +31,8 @@ namespace crystal {
 	#define real_cos cosf
 	#define real_asin asinf
 	#define real_acos acosf
+	#define real_floor floorf
+	#define real_ceil ceilf
 	#define defalut_gravity -9.8f
 	typedef std::string String;
 
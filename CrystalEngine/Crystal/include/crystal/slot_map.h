@@ -0,0 +1,196 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+//Marks the end of the list of free slots of a slot map
+#define NO_FREE_SLOT 0xffffffff
+
+namespace crystal {
+
+	/**
+	* Names an item of a slot map. The index is the item's slot, which
+	* doesn't change while the item is in the map. The generation of a
+	* slot is bumped each time its item is removed, so a handle to a
+	* removed item never finds the item that takes the slot next.
+	*
+	* A default handle names nothing, as no slot has generation zero.
+	*/
+	struct Handle
+	{
+		unsigned index;
+		unsigned generation;
+
+		Handle() :index(0), generation(0) {}
+		Handle(unsigned index, unsigned generation) :index(index), generation(generation) {}
+
+		bool operator==(const Handle& other) const
+		{
+			return index == other.index && generation == other.generation;
+		}
+
+		bool operator!=(const Handle& other) const
+		{
+			return !(*this == other);
+		}
+	};
+
+	typedef Handle BodyHandle;
+	typedef Handle ColliderHandle;
+
+	/**
+	* Holds a set of items in a dense array, named by handles that
+	* stay valid while the array is compacted. Each slot holds the
+	* index of its item in the dense array, and each item the index of
+	* its slot. An item is removed by moving the last item into its
+	* place, so adding, finding and removing an item take constant time,
+	* and looping over the items runs down the dense array. Removing an
+	* item changes the order of the items left.
+	*/
+	template<class T>
+	class SlotMap
+	{
+	protected:
+		struct Slot
+		{
+			unsigned generation;
+
+			//The index of the item in the dense array, or the next free slot
+			unsigned item;
+		};
+
+		std::vector<T> items;
+
+		//Holds the slot of each item in the dense array
+		std::vector<unsigned> itemSlots;
+
+		std::vector<Slot> slots;
+
+		//Holds the first free slot, or NO_FREE_SLOT
+		unsigned freeSlot;
+
+	public:
+		SlotMap() :freeSlot(NO_FREE_SLOT) {}
+
+		//Adds an item to the end of the dense array, returning its handle
+		Handle add(const T& item)
+		{
+			unsigned slot = freeSlot;
+			if (slot == NO_FREE_SLOT)
+			{
+				slot = slots.size();
+				Slot newSlot = { 1, 0 };
+				slots.push_back(newSlot);
+			}
+			else
+			{
+				freeSlot = slots[slot].item;
+			}
+
+			slots[slot].item = items.size();
+			items.push_back(item);
+			itemSlots.push_back(slot);
+			return Handle(slot, slots[slot].generation);
+		}
+
+		//Checks if the handle names an item still in the map
+		bool contains(Handle handle) const
+		{
+			return handle.index < slots.size() && slots[handle.index].generation == handle.generation;
+		}
+
+		//Gets the item named by the handle, or NULL if it has been removed
+		T* get(Handle handle)
+		{
+			return contains(handle) ? &items[slots[handle.index].item] : NULL;
+		}
+
+		const T* get(Handle handle) const
+		{
+			return contains(handle) ? &items[slots[handle.index].item] : NULL;
+		}
+
+		//Gets the handle of the item at the given index of the dense array
+		Handle getHandle(unsigned index) const
+		{
+			unsigned slot = itemSlots[index];
+			return Handle(slot, slots[slot].generation);
+		}
+
+		/**
+		* Removes the item named by the handle, moving the last item into
+		* its place. Returns false if the handle names no item.
+		*/
+		bool remove(Handle handle)
+		{
+			if (!contains(handle)) return false;
+			removeAt(slots[handle.index].item);
+			return true;
+		}
+
+		//Removes the item at the given index of the dense array
+		void removeAt(unsigned index)
+		{
+			unsigned slot = itemSlots[index];
+			unsigned last = items.size() - 1;
+			if (index != last)
+			{
+				items[index] = std::move(items[last]);
+				itemSlots[index] = itemSlots[last];
+				slots[itemSlots[index]].item = index;
+			}
+			items.pop_back();
+			itemSlots.pop_back();
+
+			// Free the slot, so its handles no longer match
+			slots[slot].generation++;
+			if (slots[slot].generation == 0) slots[slot].generation = 1;
+			slots[slot].item = freeSlot;
+			freeSlot = slot;
+		}
+
+		/**
+		* Removes every item the given function returns true for, in one
+		* pass over the dense array. The function is called once for each
+		* item.
+		*/
+		template<class Predicate>
+		void removeIf(Predicate predicate)
+		{
+			for (unsigned i = items.size(); i > 0; i--)
+			{
+				if (predicate(items[i - 1])) removeAt(i - 1);
+			}
+		}
+
+		const std::vector<T>& getItems() const
+		{
+			return items;
+		}
+
+		unsigned size() const
+		{
+			return items.size();
+		}
+
+		bool empty() const
+		{
+			return items.empty();
+		}
+
+		T& operator[](unsigned index)
+		{
+			return items[index];
+		}
+
+		const T& operator[](unsigned index) const
+		{
+			return items[index];
+		}
+
+		typename std::vector<T>::iterator begin() { return items.begin(); }
+		typename std::vector<T>::iterator end() { return items.end(); }
+		typename std::vector<T>::const_iterator begin() const { return items.begin(); }
+		typename std::vector<T>::const_iterator end() const { return items.end(); }
+	};
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//The number of tasks a range is split into for each worker, so idle workers have some to steal
+#define RANGE_TASKS_PER_WORKER 4
+
+namespace crystal {
+
+	/**
+	* A fixed pool of worker threads running a batch of tasks at a time.
+	*
+	* The calling thread takes part in every batch as worker 0, so a
+	* pool of one worker runs everything on the calling thread. Tasks
+	* are dealt to the workers in the given order, and each worker runs
+	* its own tasks from the first one on. A worker that runs out of
+	* tasks steals the last task of another worker, so when the tasks
+	* are given largest first, idle workers pick up the small ones.
+	*/
+	class WorkerPool
+	{
+	public:
+		//Runs a task on the given worker
+		typedef std::function<void(unsigned task, unsigned worker)> TaskFunction;
+
+		//Runs a task over the items from first up to, but not including, last
+		typedef std::function<void(unsigned first, unsigned last)> RangeFunction;
+
+	protected:
+		/**
+		* Holds the tasks dealt to a worker. The worker takes them from
+		* the front, other workers steal them from the back.
+		*/
+		struct TaskQueue
+		{
+			std::mutex lock;
+			std::vector<unsigned> tasks;
+			unsigned front;
+			unsigned back;
+		};
+
+		unsigned workerCount;
+
+		TaskQueue* queues;
+
+		std::vector<std::thread> threads;
+
+		//Guards the batch state below
+		std::mutex batchLock;
+		std::condition_variable batchStarted;
+		std::condition_variable batchFinished;
+
+		//Counts the batches, so the threads can tell a new batch from a spurious wake up
+		unsigned batchCount;
+
+		//Number of threads still working on the current batch
+		unsigned busyThreads;
+
+		bool stopping;
+
+		const TaskFunction* taskFunction;
+
+		//Holds the chunks of the range being run by runRange
+		std::vector<unsigned> rangeTasks;
+
+		//Gets the next task of a worker, stealing one if it has none left
+		bool nextTask(unsigned worker, unsigned& task);
+
+		//Runs tasks on a worker until none are left
+		void work(unsigned worker);
+
+		//The loop of each thread of the pool
+		void threadLoop(unsigned worker);
+
+	public:
+		/**
+		* Creates a pool with the given number of workers, including
+		* the calling thread.
+		*/
+		WorkerPool(unsigned workerCount);
+
+		~WorkerPool();
+
+		unsigned getWorkerCount() const
+		{
+			return workerCount;
+		}
+
+		/**
+		* Runs the given tasks and returns when all of them are done.
+		* Tasks given first are started first.
+		*/
+		void run(const std::vector<unsigned>& tasks, const TaskFunction& function);
+
+		/**
+		* Runs the given function over the items from 0 to count, split
+		* into chunks shared out between the workers. Each chunk has at
+		* least minimumChunk items, so small ranges are run on the
+		* calling thread in one go. Chunks start on a multiple of
+		* alignment, so a function working on groups of that many items
+		* never has two workers in the same group.
+		*/
+		void runRange(unsigned count, unsigned minimumChunk,
+			const RangeFunction& function, unsigned alignment = 1);
+	};
+}
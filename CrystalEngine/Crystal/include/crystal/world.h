@@ -3,14 +3,33 @@
 #include "contact.h"
 #include "fgen.h"
 #include "collide_fine.h"
+#include "collide_coarse.h"
+#include "island.h"
+#include "workers.h"
+#include "slot_map.h"
 #include <memory>
+#include <unordered_map>
 
 #define DEFAULT_COLLECT_GAP 2
+//The default half extent of the world along each axis
+#define DEFAULT_WORLD_EXTENT 100.0f
+//Islands with this many contacts have their colors shared out between the workers
+#define PARALLEL_ISLAND_CONTACTS 256
+//The fewest colliders a worker updates in one task
+#define COLLIDERS_PER_TASK 256
+//The default number of fixed steps the world takes per second of simulated time
+#define DEFAULT_STEP_RATE 60
+//The default largest number of fixed steps the world takes in one frame
+#define DEFAULT_MAX_SUB_STEPS 5
 
 #ifndef CallbackMethods
 #define CallbackMethod(name) void(*name)(World* world,CollisionPrimitive* thisBody,CollisionPrimitive* other)
 #endif // !CallbackMethods
 
+#ifndef EventMethods
+#define EventMethod(name) void(*name)(World* world,const CollisionEvent& event,CollisionPrimitive* thisBody,CollisionPrimitive* other)
+#endif // !EventMethods
+
 
 #ifndef CallbackList
 #define CallbackList std::vector<CallbackMethod()>
@@ -20,11 +39,54 @@
 
 namespace crystal {
 
+	//The kinds of collision event
+	enum CollisionEventType
+	{
+		//The pair started touching in this step
+		COLLISION_BEGIN,
+		//The pair touched in the last step and still touches
+		COLLISION_PERSIST,
+		//The pair touched in the last step and no longer does, or one of them was deleted
+		COLLISION_END
+	};
+
+	/**
+	* Reports a change in the contact between a pair of colliders. The
+	* colliders are in the order they were checked, lowest id first.
+	*/
+	struct CollisionEvent
+	{
+		CollisionEventType type;
+		CollisionPrimitive* collider[2];
+		//The number of contacts the pair generated, zero for an end event or a dropped pair
+		unsigned contactCount;
+	};
+
 	using BodyPtr = std::shared_ptr<RigidBody>;
 	using ColliderPtr = std::shared_ptr<CollisionPrimitive>;
 	using RigidBodyList = std::vector<BodyPtr>;
 	using ColliderList = std::vector<ColliderPtr>;
 
+	/**
+	* Reports how the contact resolver did over all the islands of a
+	* frame.
+	*/
+	struct ResolverStats
+	{
+		//The iterations, or sweeps, used by all the islands together
+		unsigned velocityIterations;
+		unsigned positionIterations;
+
+		//The largest velocity change left to make in any island
+		real velocityResidual;
+
+		//The deepest penetration left in any island
+		real positionResidual;
+
+		//True if any island ran out of its share of the time budget
+		bool budgetExceeded;
+	};
+
 	class World
 	{
 	public:
@@ -39,27 +101,113 @@ namespace crystal {
 		bool calculateIterations;
 
 		/**
-		* Holds a rigidbody's id and its corresponding colliders
-		* Currently it is a one-one relation.
+		* Holds the number of resolver iterations given to each contact
+		* of an island, when the number of iterations is not calculated
+		* at each frame.
 		*/
-		struct RigidBodyRegistration
-		{
-			unsigned bodyId;
-			unsigned colliderId;
-
-			RigidBodyRegistration(unsigned bid,unsigned cid):bodyId(bid),colliderId(cid){}
-		};
+		unsigned iterationsPerContact;
 
-		std::vector<RigidBodyRegistration> bodyColliderReg;
+		/**
+		* Holds the state of the rigidbodies added to the world, so
+		* they can be integrated together. It is declared before the
+		* list, so the bodies leave it before it goes.
+		*/
+		BodyStore bodyStore;
 
-		/*Holds the list of rigidbodies*/
-		RigidBodyList bodyList;
+		/**
+		* Holds the rigidbodies, named by their handles. A body links
+		* straight to the collider added with it, and the collider to
+		* the body.
+		*/
+		SlotMap<BodyPtr> bodyList;
 
 		/**
 		* Holds the resolver for sets of contacts.
 		*/
 		ContactResolver resolver;
 
+		//Splits the contacts of each frame into islands
+		IslandBuilder islands;
+
+		//Holds the contacts of the frame laid out island by island
+		std::vector<Contact> islandContacts;
+
+		//Holds the workers resolving the islands, NULL to resolve them on the calling thread
+		WorkerPool* workers;
+
+		//Holds a copy of the resolver for each worker
+		std::vector<ContactResolver> workerResolvers;
+
+		//Holds the islands in the order they are handed to the workers
+		std::vector<unsigned> islandTasks;
+
+		//Holds the most microseconds the resolver may take in a frame, zero for no limit
+		unsigned resolverBudget;
+
+		//Holds how the resolver did on each island of the last frame
+		std::vector<ResolverStats> islandStats;
+
+		//Holds how the resolver did over the whole of the last frame
+		ResolverStats resolverStats;
+
+		//Holds the duration of each fixed step taken by step
+		real stepDuration;
+
+		//Holds the largest number of fixed steps step takes in one call
+		unsigned maxSubSteps;
+
+		//Holds the time passed that the fixed steps haven't covered yet
+		real stepAccumulator;
+
+		//Holds the total time dropped because a frame needed too many steps
+		real droppedTime;
+
+		//Calculates the internals of the active colliders of awake bodies
+		void updateColliders();
+
+		/**
+		* Resolves one island with the given resolver, giving it its
+		* share of the iterations and of the time budget, and keeps its
+		* stats.
+		*/
+		void resolveIsland(unsigned index, ContactResolver& islandResolver, real duration);
+
+		/**
+		* Resolves the contact islands of the frame, on the workers if
+		* there are any, and gathers the stats of the resolver. Islands
+		* share no moving body, so without a time budget the result
+		* doesn't depend on the number of workers.
+		*/
+		void resolveIslands(real duration);
+
+		/**
+		* Resolves the contact islands on the workers. In the sequential
+		* impulse mode, large islands are resolved one at a time with
+		* each of their colors shared out between the workers.
+		*/
+		void resolveIslandsOnWorkers(real duration);
+
+		//Marks the bodies, by slot, that are ready to fall asleep in this frame
+		std::vector<bool> readyToSleep;
+
+		/**
+		* Checks if a body was marked ready to fall asleep. Bodies that
+		* are not in the world's store, such as those of colliders added
+		* on their own, are never ready, so they keep their island awake.
+		*/
+		bool isReadyToSleep(const RigidBody* body) const
+		{
+			return body->getStore() == &bodyStore && readyToSleep[body->getSlot()];
+		}
+
+		/**
+		* Puts to sleep the bodies that have been still for long enough.
+		* A body in contact with others only falls asleep with all the
+		* other moving bodies of its island, so a stack never falls
+		* asleep under a moving body.
+		*/
+		void updateSleep();
+
 		/**
 		* Holds one contact generators in a linked list.
 		*/
@@ -69,8 +217,8 @@ namespace crystal {
 			ContactGenRegistration *next;
 		};
 
-		/* Holds the list of colliders. Only support primitive colliders now */
-		ColliderList colliders;
+		/* Holds the colliders, named by their handles. Only support primitive colliders now */
+		SlotMap<ColliderPtr> colliders;
 
 		//Holds number of rigidbodys
 		unsigned bodyCount;
@@ -91,57 +239,435 @@ namespace crystal {
 		Contact *contacts;
 
 		/**
-		* Holds the maximum number of contacts allowed (i.e. the size
-		* of the contacts array).
+		* Holds the number of contacts the contact array can take. The
+		* array grows when a frame generates more contacts and keeps its
+		* size between frames, so it settles at the largest frame seen.
 		*/
 		unsigned maxContacts;
 
+		//Holds the most contacts the array may grow to, zero for no limit
+		unsigned contactLimit;
+
+		//Counts the pairs checked without room for all their contacts in the last frame
+		unsigned contactOverflows;
+
+		//Counts the pairs not checked at all in the last frame, as the contact array was full
+		unsigned droppedPairs;
+
 		/** Holds the collision data structure for collision detection. */
 		CollisionData cData;
-		
-		void addCollider(CollisionPrimitive* collider);
 
-		//Holds callback methods
-		CallbackList collisionCallbacks;
+		/**
+		* Holds the broad phase used to find the pairs of colliders
+		* that need to be checked by the fine collision detection.
+		*/
+		Broadphase* broadphase;
+
+		//Holds the type of the current broad phase
+		BroadphaseType broadphaseType;
+
+		//Holds the cell size used by the spatial grid broad phase
+		real gridCellSize;
 
-		/*Holds a collider and its corrensponding callback method's index in @collisionCallbacks*/
-		struct ColliderCallbackIndex
+		/**
+		* Holds the size of the world. The world spans from -worldSize
+		* to worldSize along each axis.
+		*/
+		Vector3 worldSize;
+
+		//Holds the pairs reported by the broad phase in this frame
+		std::vector<PotentialContact> potentialContacts;
+
+		/**
+		* The sets a collider can be in. Only awake dynamic colliders are
+		* kept in the broad phase. Static colliders (planes and colliders of
+		* bodies with infinite mass) and the colliders of sleeping bodies
+		* are only checked against awake dynamic colliders. The sets are
+		* checked every frame, so a body that falls asleep, wakes up or
+		* changes between finite and infinite mass moves to its new set.
+		*/
+		enum ColliderSet
+		{
+			COLLIDER_DYNAMIC,
+			COLLIDER_STATIC,
+			COLLIDER_DORMANT
+		};
+
+		//Holds the set each collider is in
+		std::unordered_map<CollisionPrimitive*, ColliderSet> colliderSets;
+
+		//Holds the static colliders. They are never checked against each other.
+		//Their bounds are refreshed every frame, so static bodies may be moved
+		AABBTreeBroadphase staticSet;
+
+		//Holds the colliders of sleeping bodies. They are woken by overlapping an awake collider
+		AABBTreeBroadphase dormantSet;
+
+		//Holds the results of static and dormant set queries
+		std::vector<CollisionPrimitive*> queryResult;
+
+		/**
+		* Holds the persistent data of a pair of colliders that was
+		* reported by the broad phase.
+		*/
+		struct PairCacheEntry
 		{
-			CollisionPrimitive* collider;
-			unsigned index;
+			ContactManifold manifold;
+			//The last frame the pair was reported in
+			unsigned lastFrame;
+			//The axis that separated the pair in the last check, for box-box pairs
+			unsigned separatingAxis;
+			//The colliders of the pair, and whether they touched in the last check
+			CollisionPrimitive* collider[2];
+			bool touching;
+
+			PairCacheEntry() :lastFrame(0), separatingAxis(NO_SEPARATING_AXIS), touching(false) {}
 		};
 
-		std::vector<ColliderCallbackIndex> indexList;
+		//Holds the cached pairs, keyed by the ids of their colliders
+		std::unordered_map<unsigned long long, PairCacheEntry> pairCache;
 
+		//Holds the manifold point each contact in the contact array was written from
+		std::vector<ManifoldPoint*> contactPoints;
+
+		//Counts the frames, used to drop pairs that are no longer reported
+		unsigned frameCount;
+
+		/**
+		* Runs the given collide function on a pair, merges the result
+		* into the pair's manifold and writes the manifold's points into
+		* the contact array. Returns the number of written contacts.
+		*/
+		unsigned collidePair(CollideFunction collide, CollisionPrimitive* one, CollisionPrimitive* two);
+
+		/**
+		* Makes room for the given number of new contacts, growing the
+		* contact array if needed. Returns false if the contact limit
+		* stops it from growing that far.
+		*/
+		bool reserveContacts(unsigned count);
+
+		//Checks if a collider belongs to the static set
+		static bool isStatic(CollisionPrimitive* collider);
+
+		//Gets the set a collider belongs in now
+		static ColliderSet getColliderSet(CollisionPrimitive* collider);
+
+		//Gets the box the static and dormant sets are queried with for a collider
+		static BoundingBox getQueryBox(CollisionPrimitive* collider);
+
+		//Holds the sleeping colliders woken in this frame, in the order they were woken
+		std::vector<CollisionPrimitive*> wokenColliders;
+
+		//Checks if an active collider was left out of the checks of this frame, being static or asleep
+		bool isResting(CollisionPrimitive* collider);
+
+		//Puts a collider into the set it belongs in
+		void addToSet(CollisionPrimitive* collider);
+
+		/**
+		* Moves the colliders whose bodies fell asleep, woke up or changed
+		* mass to their new sets, and refreshes the bounds of the static set.
+		*/
+		void updateColliderSets();
+
+		//Wakes the sleeping colliders that overlap a collider, moving them to the broad phase
+		void wakeOverlapping(CollisionPrimitive* collider);
+
+		/**
+		* Wakes the sleeping bodies whose colliders overlap an awake
+		* dynamic one. The woken colliders wake the ones they overlap in
+		* turn. This is done before the broad phase is asked for its pairs,
+		* so the woken colliders are checked against everything this frame.
+		*/
+		void wakeDormantColliders();
+
+		//Finds the pairs between awake dynamic colliders and the static set
+		void getStaticContacts();
+		
+		ColliderHandle addCollider(CollisionPrimitive* collider);
+
+		/**
+		* Holds the methods called for the events of a collider. Each
+		* collider names its own callback by a handle, so dispatching
+		* an event doesn't search for it.
+		*/
+		struct CollisionCallback
+		{
+			CallbackMethod(onCollision);
+			EventMethod(onEvent);
+		};
+
+		SlotMap<CollisionCallback> collisionCallbacks;
+
+		//Gets the callback of a collider, giving it one if it has none
+		CollisionCallback& getCallback(CollisionPrimitive* collider);
+
+		/**
+		* Holds the collision events of the step. Contact generation
+		* only writes them, and they are dispatched once the step is
+		* done, so no user code runs while the contacts are generated.
+		*/
+		std::vector<CollisionEvent> collisionEvents;
+
+		//Adds an event for a pair of colliders
+		void addEvent(CollisionEventType type, CollisionPrimitive* one, CollisionPrimitive* two, unsigned contactCount);
+
+		/**
+		* Calls the callbacks of the colliders of each event of the
+		* step. Collision methods are only called while both colliders
+		* are active, so a body deleted by a callback takes no further
+		* collision calls.
+		*/
+		void dispatchEvents();
+
+		/**
+		* Hold the bodies and colliders removed in this step. They are
+		* kept alive until the events of the step, which may point to
+		* them, have been dispatched.
+		*/
+		RigidBodyList retiredBodies;
+		ColliderList retiredColliders;
+
+		//Gets the collider added with a body of the world, or NULL
 		CollisionPrimitive* getAttachedCollider(RigidBody* body);
 
-		void resetColliderBodies();
+		//Takes a collider out of the broad phase or the set it is in
+		void removeFromSets(CollisionPrimitive* collider);
 
 	public:
 		/**
-		* Creates a new simulator that can handle up to the given
-		* number of contacts per frame. You can also optionally give
-		* a number of contact-resolution iterations to use. If you
-		* don't give a number of iterations, then four times the
-		* number of detected contacts will be used for each frame.
+		* Creates a new simulator with room for the given number of
+		* contacts per frame. The room grows when a frame needs more.
+		* You can also optionally give a number of contact-resolution
+		* iterations to use for each contact. If you don't give a number
+		* of iterations, then four times the number of detected contacts
+		* will be used. Each contact island is resolved separately, with
+		* iterations for its own contacts. The resolver stops as soon as
+		* the contacts are within its tolerances, and a time budget can
+		* bound it further with setResolverBudget.
 		*/
 		World(unsigned maxContacts = 20, unsigned iterations = 0);
 		
 		~World();
 
+		/**
+		* Sets the method called after each step in which the collider
+		* of the body touched another. Callbacks may delete bodies; the
+		* deleted bodies take no further calls and are removed later.
+		*/
 		void addCallbackMethod(RigidBody* body,CallbackMethod(method));
 
-		RigidBodyList& getRigidBodyList()
+		//Sets the method called for every collision event of the collider of the body
+		void addEventMethod(RigidBody* body, EventMethod(method));
+
+		/**
+		* Gets the collision events of the last step, in the order the
+		* pairs were checked, followed by the end events.
+		*/
+		const std::vector<CollisionEvent>& getCollisionEvents() const
+		{
+			return collisionEvents;
+		}
+
+		const RigidBodyList& getRigidBodyList() const
+		{
+			return bodyList.getItems();
+		}
+
+		/**
+		* Adds a body to the world, with the collider that represents
+		* it if there is one. The world takes ownership of both. Returns
+		* the handle of the body, which stays valid until the body is
+		* removed, however the other bodies are added or removed.
+		*/
+		BodyHandle addRigidBody(RigidBody* const body, CollisionPrimitive* const collider = NULL);
+
+		//Gets the body named by the handle, or NULL if it has been removed
+		RigidBody* getBody(BodyHandle handle)
+		{
+			BodyPtr* body = bodyList.get(handle);
+			return body ? body->get() : NULL;
+		}
+
+		//Gets the collider named by the handle, or NULL if it has been removed
+		CollisionPrimitive* getCollider(ColliderHandle handle)
+		{
+			ColliderPtr* collider = colliders.get(handle);
+			return collider ? collider->get() : NULL;
+		}
+
+		/**
+		* Changes the broad phase algorithm of the world. All current
+		* colliders are moved to the new broad phase. The cell size is
+		* only used by the spatial grid.
+		*/
+		void setBroadphase(BroadphaseType type, real cellSize = DEFAULT_GRID_CELL_SIZE);
+
+		/**
+		* Sets the fraction of the last frame's contact impulses used to
+		* warm start the contact resolver. Zero disables warm starting.
+		*/
+		void setWarmStartFactor(real factor)
 		{
-			return bodyList;
+			resolver.setWarmStartFactor(factor);
 		}
 
-		void addRigidBody(RigidBody* const body, CollisionPrimitive* const collider = NULL);
+		/**
+		* Sets how the contact resolver resolves velocities. The
+		* sequential impulse mode makes the given number of sweeps over
+		* the contacts of each island. Stacks need a warm start factor
+		* close to one in this mode, so each frame starts from the
+		* impulses that held them up in the last one.
+		*/
+		void setResolverMode(ResolverMode mode, unsigned sweeps = DEFAULT_RESOLVER_SWEEPS)
+		{
+			resolver.setMode(mode, sweeps);
+		}
+
+		/**
+		* Sets how the contact resolver removes penetration. The split
+		* impulse stage removes the given fraction of each contact's
+		* penetration in each frame, without adding to the velocities
+		* of the bodies, which keeps stacks from jittering.
+		*/
+		void setPositionMode(PositionMode mode, real factor = DEFAULT_SPLIT_IMPULSE_FACTOR)
+		{
+			resolver.setPositionMode(mode, factor);
+		}
 
-		//Delete a rigidbody and its attached collider (if any)
+		/**
+		* Sets the tolerances the contact resolver stops at. Contacts
+		* closing slower than the velocity tolerance, or penetrating
+		* less than the position tolerance, are left as they are.
+		*/
+		void setResolverTolerance(real velocity, real position)
+		{
+			resolver.setEpsilon(velocity, position);
+		}
+
+		/**
+		* Sets the most time in microseconds the contact resolver may
+		* take in each frame, or zero for no limit. Each island gets a
+		* share of the budget by its number of contacts. An island that
+		* runs out of time is left partly resolved rather than holding
+		* up the frame, and the next frame carries on from there.
+		*/
+		void setResolverBudget(unsigned microseconds)
+		{
+			resolverBudget = microseconds;
+		}
+
+		unsigned getResolverBudget() const
+		{
+			return resolverBudget;
+		}
+
+		//Gets how the contact resolver did in the last frame
+		const ResolverStats& getResolverStats() const
+		{
+			return resolverStats;
+		}
+
+		Broadphase* getBroadphase()
+		{
+			return broadphase;
+		}
+
+		/**
+		* Sets the number of threads resolving the contact islands and
+		* integrating the bodies, including the calling thread. One, the
+		* default, does it all on the calling thread.
+		*/
+		void setWorkerCount(unsigned count);
+
+		unsigned getWorkerCount() const
+		{
+			return workers ? workers->getWorkerCount() : 1;
+		}
+
+		/**
+		* Sets the most contacts the contact array may grow to. Zero, the
+		* default, lets it grow without limit.
+		*/
+		void setContactLimit(unsigned limit)
+		{
+			contactLimit = limit;
+		}
+
+		//Gets the number of contacts the contact array can take
+		unsigned getContactCapacity() const
+		{
+			return maxContacts;
+		}
+
+		/**
+		* Gets the number of pairs that were checked without room for all
+		* their contacts in the last frame, because of the contact limit.
+		*/
+		unsigned getContactOverflows() const
+		{
+			return contactOverflows;
+		}
+
+		/**
+		* Gets the number of pairs left unchecked in the last frame, as
+		* the contact limit was already reached. They are counted in the
+		* overflows too. A dropped pair that was touching gives a persist
+		* event with no contacts, and keeps its cached contact points.
+		*/
+		unsigned getDroppedPairs() const
+		{
+			return droppedPairs;
+		}
+
+		/**
+		* Gets the number of box pairs rejected by their cached separating
+		* axis in the last frame.
+		*/
+		unsigned getAxisCacheHits() const
+		{
+			return cData.axisCacheHits;
+		}
+
+		/**
+		* Gets the number of box pairs whose cached separating axis no
+		* longer separated them in the last frame.
+		*/
+		unsigned getAxisCacheMisses() const
+		{
+			return cData.axisCacheMisses;
+		}
+
+		/**
+		* Sets the size of the world. The world spans from -size to size
+		* along each axis. The spatial grid broad phase is rebuilt to cover
+		* the new size.
+		*/
+		void setWorldSize(const Vector3& size);
+
+		const Vector3& getWorldSize() const
+		{
+			return worldSize;
+		}
+
+		/**
+		* Delete a rigidbody and its attached collider (if any). They
+		* are only marked inactive here, and removed by a later step,
+		* so it is safe to call from a collision callback. Pairs the
+		* collider touched get an end event in the next step.
+		*/
 		void deleteBody(RigidBody* body);
+
+		//Delete the rigidbody named by the handle, if it is still in the world
+		void deleteBody(BodyHandle handle);
 		
-		//The method deleteBody uses a lazy delete strategy. Call this method to remove all inActive colliders in list
+		/**
+		* The method deleteBody uses a lazy delete strategy. Call this
+		* method to remove all inActive bodies and colliders in one pass.
+		* The last items of each list move into the freed places, so
+		* handles stay valid but the order of the lists changes.
+		*/
 		void removeInActiveBodies();
 
 		/**
@@ -159,9 +685,73 @@ namespace crystal {
 		* Initialises the world for a simulation frame. This clears
 		* the force and torque accumulators for bodies in the
 		* world. After calling this, the bodies can have their forces
-		* and torques for this frame added.
+		* and torques for this frame added. Sleeping bodies keep their
+		* derived data, so wake a sleeping body up after moving it.
+		* With more than one worker, the bodies and colliders are
+		* split between the workers.
 		*/
 		void startFrame();
+
+		/**
+		* Advances the world by the given frame duration in fixed
+		* steps. The time is added to an accumulator, and runPhysics
+		* is called with the step duration for each whole step in it,
+		* so the cost of a second of simulated time doesn't depend on
+		* the frame rate. Time left over is carried into the next
+		* frame. Returns the number of steps taken.
+		*
+		* At most the maximum number of sub steps are taken. If a frame
+		* needs more, the time of the extra steps is dropped rather
+		* than carried over, so a slow frame doesn't make the next one
+		* slower still.
+		*
+		* Call startFrame before adding the forces of the frame, as
+		* with runPhysics. Those forces are used by the first step; the
+		* force registry is updated at every step. The colliders are
+		* brought up to date by startFrame for the first step, so
+		* bodies placed by hand should be moved before it.
+		*/
+		unsigned step(real frameDuration);
+
+		//Sets the number of fixed steps taken per second of simulated time
+		void setStepRate(unsigned stepsPerSecond)
+		{
+			stepDuration = ((real)1) / (stepsPerSecond > 0 ? stepsPerSecond : 1);
+		}
+
+		real getStepDuration() const
+		{
+			return stepDuration;
+		}
+
+		//Sets the largest number of fixed steps taken in one frame
+		void setMaxSubSteps(unsigned count)
+		{
+			maxSubSteps = count > 0 ? count : 1;
+		}
+
+		unsigned getMaxSubSteps() const
+		{
+			return maxSubSteps;
+		}
+
+		/**
+		* Gets how far the world is between its last two steps, as the
+		* fraction of a step the accumulator holds. Pass it to
+		* RigidBody::getInterpolatedPosition and getInterpolatedOrientation
+		* to draw the bodies between the two states, at the time the
+		* frame has really reached.
+		*/
+		real getInterpolationFactor() const
+		{
+			return stepAccumulator / stepDuration;
+		}
+
+		//Gets the total time dropped because frames needed too many steps
+		real getDroppedTime() const
+		{
+			return droppedTime;
+		}
 	};
 
  }
\ No newline at end of file
@@ -5,52 +5,60 @@ using namespace crystal;
 
 unsigned RigidBody::CurrentID = 0;
 
+RigidBody::RigidBody(const RigidBody& other) :store(NULL), collider(NULL), mass(other.mass),
+	tag(other.tag), isActive(other.isActive)
+{
+	id = RigidBody::CurrentID++;
+	BodyStore& loose = BodyStore::getLooseStore();
+	loose.add(this);
+	loose.copySlot(slot, *other.store, other.slot);
+}
+
+RigidBody& RigidBody::operator=(const RigidBody& other)
+{
+	if (this == &other) return *this;
+	mass = other.mass;
+	tag = other.tag;
+	isActive = other.isActive;
+	store->copySlot(slot, *other.store, other.slot);
+	return *this;
+}
+
+RigidBody::~RigidBody()
+{
+	if (store) store->remove(this);
+}
+
 void RigidBody::addForce(const Vector3& force)
 {
-	forceAccum += force;
+	store->forceAccum.add(slot, force);
+	if (!getAwake()) setAwake();
 }
 
 void RigidBody::addTorque(const Vector3& force)
 {
-	torqueAccum += force;
+	store->torqueAccum.add(slot, force);
+	if (!getAwake()) setAwake();
 }
 
 void RigidBody::integrate(real duration)
 {
-	//update linear motion
-	//update acceleration
-	Vector3 lastFrameLinearAcc = acceleration;
-	lastFrameLinearAcc.addScaledVector(forceAccum,inverseMass);
-	//update velocity
-	velocity.addScaledVector(lastFrameLinearAcc*linearFactor, duration);
-	//Impose drag
-	velocity *= real_pow(linearDamping, duration);
-	//update position
-	position.addScaledVector(velocity, duration);
-	
-	//update angular motion
-	//Get angular acceleration from torque
-	Vector3 angularAcceleration = inverseInertiaTensorWorld.transform(torqueAccum);
-	//update rotation speed
-	rotation.addScaledVector(angularAcceleration*angularFactor, duration);
-	//impose drag
-	rotation *= real_pow(angularDamping, duration);
-	//update orientation
-	orientation.addScaledVector(rotation,duration);
-
-	// Normalise the orientation, and update the matrices with the new position and orientation
-	calculateDerivedData();
-	//clear both accumlators
-	clearAccumulators();
+	//Sleeping bodies don't move
+	if (!getAwake()) return;
+
+	// The store does the same integration for all its bodies at once
+	store->updateDrag(duration);
+	store->integrateRange(slot, slot + 1, duration);
 }
 
 void RigidBody::addForceAtPoint(const Vector3& force, const Vector3& point)
 {
 	//add force
-	forceAccum += force;
+	store->forceAccum.add(slot, force);
 	//add torque
-	Vector3 torque = (point - position) % force;
-	torqueAccum += torque;
+	Vector3 torque = (point - getPosition()) % force;
+	store->torqueAccum.add(slot, torque);
+	if (!getAwake()) setAwake();
 }
 
 void RigidBody::addForceAtBodyPoint(const Vector3& force, const Vector3& point)
@@ -61,135 +69,31 @@ void RigidBody::addForceAtBodyPoint(const Vector3& force, const Vector3& point)
 
 void RigidBody::setInertiaTensor(const Matrix3& inertiaTensor)
 {
+	Matrix3 inverseInertiaTensor;
 	inverseInertiaTensor.setInverse(inertiaTensor);
-}
-
-/**
- * Inline function that creates a transform matrix from a
- * position and orientation.
-*/
-static inline void _calculateTransformMatrix(Matrix4 &transformMatrix,
-	const Vector3 &position,
-	const Quaternion &orientation)
-{
-	transformMatrix.data[0] = 1 - 2 * orientation.j*orientation.j -
-		2 * orientation.k*orientation.k;
-	transformMatrix.data[1] = 2 * orientation.i*orientation.j -
-		2 * orientation.r*orientation.k;
-	transformMatrix.data[2] = 2 * orientation.i*orientation.k +
-		2 * orientation.r*orientation.j;
-	transformMatrix.data[3] = position.x;
-
-	transformMatrix.data[4] = 2 * orientation.i*orientation.j +
-		2 * orientation.r*orientation.k;
-	transformMatrix.data[5] = 1 - 2 * orientation.i*orientation.i -
-		2 * orientation.k*orientation.k;
-	transformMatrix.data[6] = 2 * orientation.j*orientation.k -
-		2 * orientation.r*orientation.i;
-	transformMatrix.data[7] = position.y;
-
-	transformMatrix.data[8] = 2 * orientation.i*orientation.k -
-		2 * orientation.r*orientation.j;
-	transformMatrix.data[9] = 2 * orientation.j*orientation.k +
-		2 * orientation.r*orientation.i;
-	transformMatrix.data[10] = 1 - 2 * orientation.i*orientation.i -
-		2 * orientation.j*orientation.j;
-	transformMatrix.data[11] = position.z;
-}
-
-/**
-* Internal function to do an intertia tensor transform by a quaternion.
-* Note that the implementation of this function was created by an
-* automated code-generator and optimizer.
-*/
-
-static inline void _transformInertiaTensor(Matrix3 &iitWorld,
-	const Quaternion &q,
-	const Matrix3 &iitBody,
-	const Matrix4 &rotmat)
-{
-	real t4 = rotmat.data[0] * iitBody.data[0] +
-		rotmat.data[1] * iitBody.data[3] +
-		rotmat.data[2] * iitBody.data[6];
-	real t9 = rotmat.data[0] * iitBody.data[1] +
-		rotmat.data[1] * iitBody.data[4] +
-		rotmat.data[2] * iitBody.data[7];
-	real t14 = rotmat.data[0] * iitBody.data[2] +
-		rotmat.data[1] * iitBody.data[5] +
-		rotmat.data[2] * iitBody.data[8];
-	real t28 = rotmat.data[4] * iitBody.data[0] +
-		rotmat.data[5] * iitBody.data[3] +
-		rotmat.data[6] * iitBody.data[6];
-	real t33 = rotmat.data[4] * iitBody.data[1] +
-		rotmat.data[5] * iitBody.data[4] +
-		rotmat.data[6] * iitBody.data[7];
-	real t38 = rotmat.data[4] * iitBody.data[2] +
-		rotmat.data[5] * iitBody.data[5] +
-		rotmat.data[6] * iitBody.data[8];
-	real t52 = rotmat.data[8] * iitBody.data[0] +
-		rotmat.data[9] * iitBody.data[3] +
-		rotmat.data[10] * iitBody.data[6];
-	real t57 = rotmat.data[8] * iitBody.data[1] +
-		rotmat.data[9] * iitBody.data[4] +
-		rotmat.data[10] * iitBody.data[7];
-	real t62 = rotmat.data[8] * iitBody.data[2] +
-		rotmat.data[9] * iitBody.data[5] +
-		rotmat.data[10] * iitBody.data[8];
-
-	iitWorld.data[0] = t4*rotmat.data[0] +
-		t9*rotmat.data[1] +
-		t14*rotmat.data[2];
-	iitWorld.data[1] = t4*rotmat.data[4] +
-		t9*rotmat.data[5] +
-		t14*rotmat.data[6];
-	iitWorld.data[2] = t4*rotmat.data[8] +
-		t9*rotmat.data[9] +
-		t14*rotmat.data[10];
-	iitWorld.data[3] = t28*rotmat.data[0] +
-		t33*rotmat.data[1] +
-		t38*rotmat.data[2];
-	iitWorld.data[4] = t28*rotmat.data[4] +
-		t33*rotmat.data[5] +
-		t38*rotmat.data[6];
-	iitWorld.data[5] = t28*rotmat.data[8] +
-		t33*rotmat.data[9] +
-		t38*rotmat.data[10];
-	iitWorld.data[6] = t52*rotmat.data[0] +
-		t57*rotmat.data[1] +
-		t62*rotmat.data[2];
-	iitWorld.data[7] = t52*rotmat.data[4] +
-		t57*rotmat.data[5] +
-		t62*rotmat.data[6];
-	iitWorld.data[8] = t52*rotmat.data[8] +
-		t57*rotmat.data[9] +
-		t62*rotmat.data[10];
+	store->inverseInertiaTensor.set(slot, inverseInertiaTensor);
 }
 
 void RigidBody::calculateDerivedData()
 {
-	_calculateTransformMatrix(transformMatrix, position, orientation);
-	// Calculate the inertiaTensor in world space.
-	_transformInertiaTensor(inverseInertiaTensorWorld,
-		orientation,
-		inverseInertiaTensor,
-		transformMatrix);
+	store->calculateDerivedDataRange(slot, slot + 1, false);
 }
 
 Vector3 RigidBody::getPointInLocalSpace(const Vector3& point) const
 {
-	return transformMatrix.transformInverse(point);
+	return getTransform().transformInverse(point);
 }
 
 Vector3 RigidBody::getPointInWorldSpace(const Vector3& point) const
 {
-	return transformMatrix.transform(point);
+	return getTransform().transform(point);
 }
 
 void RigidBody::setMass(real mass)
 {
 	assert(mass != 0);
 	this->mass = mass;
-	inverseMass = ((real)1) / mass;
+	store->inverseMass[slot] = ((real)1) / mass;
 
 }
 
@@ -206,7 +110,7 @@ static inline void _checkInverseInertiaTensor(const Matrix3 &iitWorld)
 void RigidBody::getInertiaTensor(Matrix3 *inertiaTensor) const
 
 {
-	inertiaTensor->setInverse(inverseInertiaTensor);
+	inertiaTensor->setInverse(getInverseInertiaTensor());
 }
 
 Matrix3 RigidBody::getInertiaTensor() const
@@ -218,7 +122,7 @@ Matrix3 RigidBody::getInertiaTensor() const
 
 void RigidBody::getInertiaTensorWorld(Matrix3 *inertiaTensor) const
 {
-	inertiaTensor->setInverse(inverseInertiaTensorWorld);
+	inertiaTensor->setInverse(getInverseInertiaTensorWorld());
 }
 
 Matrix3 RigidBody::getInertiaTensorWorld() const
@@ -231,102 +135,103 @@ Matrix3 RigidBody::getInertiaTensorWorld() const
 void RigidBody::setInverseInertiaTensor(const Matrix3 &inverseInertiaTensor)
 {
 	_checkInverseInertiaTensor(inverseInertiaTensor);
-	RigidBody::inverseInertiaTensor = inverseInertiaTensor;
+	store->inverseInertiaTensor.set(slot, inverseInertiaTensor);
 }
 
 void RigidBody::getInverseInertiaTensor(Matrix3 *inverseInertiaTensor) const
 {
-	*inverseInertiaTensor = RigidBody::inverseInertiaTensor;
+	store->inverseInertiaTensor.get(slot, *inverseInertiaTensor);
 }
 
 Matrix3 RigidBody::getInverseInertiaTensor() const
 {
-	return inverseInertiaTensor;
+	Matrix3 it;
+	getInverseInertiaTensor(&it);
+	return it;
 }
 
 void RigidBody::getInverseInertiaTensorWorld(Matrix3 *inverseInertiaTensor) const
 {
-	*inverseInertiaTensor = inverseInertiaTensorWorld;
+	store->inverseInertiaTensorWorld.get(slot, *inverseInertiaTensor);
 }
 
 Matrix3 RigidBody::getInverseInertiaTensorWorld() const
 {
-	return inverseInertiaTensorWorld;
+	Matrix3 it;
+	getInverseInertiaTensorWorld(&it);
+	return it;
 }
 
 void RigidBody::setDamping(const real linearDamping,
 	const real angularDamping)
 {
-	RigidBody::linearDamping = linearDamping;
-	RigidBody::angularDamping = angularDamping;
+	setLinearDamping(linearDamping);
+	setAngularDamping(angularDamping);
 }
 
 void RigidBody::setLinearDamping(const real linearDamping)
 {
-	RigidBody::linearDamping = linearDamping;
+	store->linearDamping[slot] = linearDamping;
+	store->linearDrag[slot] = real_pow(linearDamping, store->dragDuration);
 }
 
 real RigidBody::getLinearDamping() const
 {
-	return linearDamping;
+	return store->linearDamping[slot];
 }
 
 void RigidBody::setAngularDamping(const real angularDamping)
 {
-	RigidBody::angularDamping = angularDamping;
+	store->angularDamping[slot] = angularDamping;
+	store->angularDrag[slot] = real_pow(angularDamping, store->dragDuration);
 }
 
 real RigidBody::getAngularDamping() const
 {
-	return angularDamping;
+	return store->angularDamping[slot];
 }
 
 void RigidBody::setPosition(const Vector3 &position)
 {
-	RigidBody::position = position;
+	store->position.set(slot, position);
 }
 
 void RigidBody::setPosition(const real x, const real y, const real z)
 {
-	position.x = x;
-	position.y = y;
-	position.z = z;
+	store->position.set(slot, Vector3(x, y, z));
 }
 
 void RigidBody::getPosition(Vector3 *position) const
 {
-	*position = RigidBody::position;
+	*position = store->position.get(slot);
 }
 
 Vector3 RigidBody::getPosition() const
 {
-	return position;
+	return store->position.get(slot);
 }
 
 void RigidBody::setOrientation(const Quaternion &orientation)
 {
-	RigidBody::orientation = orientation;
-	RigidBody::orientation.normalize();
+	Quaternion q = orientation;
+	q.normalize();
+	store->orientation.set(slot, q);
 }
 
 void RigidBody::setOrientation(const real r, const real i,
 	const real j, const real k)
 {
-	orientation.r = r;
-	orientation.i = i;
-	orientation.j = j;
-	orientation.k = k;
-	orientation.normalize();
+	setOrientation(Quaternion(r, i, j, k));
 }
 
 void RigidBody::getOrientation(Quaternion *orientation) const
 {
-	*orientation = RigidBody::orientation;
+	*orientation = store->orientation.get(slot);
 }
 
 Quaternion RigidBody::getOrientation() const
 {
-	return orientation;
+	return store->orientation.get(slot);
 }
 
 void RigidBody::getOrientation(Matrix3 *matrix) const
@@ -336,140 +241,199 @@ void RigidBody::getOrientation(Matrix3 *matrix) const
 
 void RigidBody::getOrientation(real matrix[9]) const
 {
-	matrix[0] = transformMatrix.data[0];
-	matrix[1] = transformMatrix.data[1];
-	matrix[2] = transformMatrix.data[2];
+	const std::vector<real>* transformMatrix = store->transformMatrix.data;
+	matrix[0] = transformMatrix[0][slot];
+	matrix[1] = transformMatrix[1][slot];
+	matrix[2] = transformMatrix[2][slot];
 
-	matrix[3] = transformMatrix.data[4];
-	matrix[4] = transformMatrix.data[5];
-	matrix[5] = transformMatrix.data[6];
+	matrix[3] = transformMatrix[4][slot];
+	matrix[4] = transformMatrix[5][slot];
+	matrix[5] = transformMatrix[6][slot];
 
-	matrix[6] = transformMatrix.data[8];
-	matrix[7] = transformMatrix.data[9];
-	matrix[8] = transformMatrix.data[10];
+	matrix[6] = transformMatrix[8][slot];
+	matrix[7] = transformMatrix[9][slot];
+	matrix[8] = transformMatrix[10][slot];
 }
 
 void RigidBody::getTransform(Matrix4 *transform) const
 {
-	memcpy(transform, &transformMatrix.data, sizeof(Matrix4));
+	store->transformMatrix.get(slot, *transform);
 }
 
 void RigidBody::getTransform(real matrix[16]) const
 {
-	memcpy(matrix, transformMatrix.data, sizeof(real) * 12);
+	for (unsigned n = 0; n < 12; n++) matrix[n] = store->transformMatrix.data[n][slot];
 	matrix[12] = matrix[13] = matrix[14] = 0;
 	matrix[15] = 1;
 }
 
 void RigidBody::getGLTransform(float matrix[16]) const
 {
-	matrix[0] = (float)transformMatrix.data[0];
-	matrix[1] = (float)transformMatrix.data[4];
-	matrix[2] = (float)transformMatrix.data[8];
+	const std::vector<real>* transformMatrix = store->transformMatrix.data;
+	matrix[0] = (float)transformMatrix[0][slot];
+	matrix[1] = (float)transformMatrix[4][slot];
+	matrix[2] = (float)transformMatrix[8][slot];
 	matrix[3] = 0;
 
-	matrix[4] = (float)transformMatrix.data[1];
-	matrix[5] = (float)transformMatrix.data[5];
-	matrix[6] = (float)transformMatrix.data[9];
+	matrix[4] = (float)transformMatrix[1][slot];
+	matrix[5] = (float)transformMatrix[5][slot];
+	matrix[6] = (float)transformMatrix[9][slot];
 	matrix[7] = 0;
 
-	matrix[8] = (float)transformMatrix.data[2];
-	matrix[9] = (float)transformMatrix.data[6];
-	matrix[10] = (float)transformMatrix.data[10];
+	matrix[8] = (float)transformMatrix[2][slot];
+	matrix[9] = (float)transformMatrix[6][slot];
+	matrix[10] = (float)transformMatrix[10][slot];
 	matrix[11] = 0;
 
-	matrix[12] = (float)transformMatrix.data[3];
-	matrix[13] = (float)transformMatrix.data[7];
-	matrix[14] = (float)transformMatrix.data[11];
+	matrix[12] = (float)transformMatrix[3][slot];
+	matrix[13] = (float)transformMatrix[7][slot];
+	matrix[14] = (float)transformMatrix[11][slot];
 	matrix[15] = 1;
 }
 
 void RigidBody::setVelocity(const Vector3 &velocity)
 {
-	RigidBody::velocity = velocity;
+	store->velocity.set(slot, velocity);
 }
 
 void RigidBody::setVelocity(const real x, const real y, const real z)
 {
-	velocity.x = x;
-	velocity.y = y;
-	velocity.z = z;
+	store->velocity.set(slot, Vector3(x, y, z));
 }
 
 void RigidBody::getVelocity(Vector3 *velocity) const
 {
-	*velocity = RigidBody::velocity;
+	*velocity = store->velocity.get(slot);
 }
 
 Vector3 RigidBody::getVelocity() const
 {
-	return velocity;
+	return store->velocity.get(slot);
 }
 
 void RigidBody::addVelocity(const Vector3 &deltaVelocity)
 {
-	velocity += deltaVelocity;
+	store->velocity.add(slot, deltaVelocity);
 }
 
 void RigidBody::setRotation(const Vector3 &rotation)
 {
-	RigidBody::rotation = rotation;
+	store->rotation.set(slot, rotation);
 }
 
 void RigidBody::setRotation(const real x, const real y, const real z)
 {
-	rotation.x = x;
-	rotation.y = y;
-	rotation.z = z;
+	store->rotation.set(slot, Vector3(x, y, z));
 }
 
 void RigidBody::getRotation(Vector3 *rotation) const
 {
-	*rotation = RigidBody::rotation;
+	*rotation = store->rotation.get(slot);
 }
 
 Vector3 RigidBody::getRotation() const
 {
-	return rotation;
+	return store->rotation.get(slot);
 }
 
 void RigidBody::addRotation(const Vector3 &deltaRotation)
 {
-	rotation += deltaRotation;
+	store->rotation.add(slot, deltaRotation);
 }
 
 void RigidBody::setAwake(const bool awake)
 {
 	if (awake) {
-		isAwake = true;
+		store->isAwake[slot] = true;
 		// Add a bit of motion to avoid it falling asleep immediately.
-		motion = sleepEpsilon*2.0f;
+		store->motion[slot] = sleepEpsilon*2.0f;
 	}
 	else {
-		isAwake = false;
-		velocity.clear();
-		rotation.clear();
+		store->isAwake[slot] = false;
+		store->velocity.clear(slot);
+		store->rotation.clear(slot);
 	}
 }
 
 Vector3 RigidBody::getDirectionInLocalSpace(const Vector3 &direction) const
 {
-	return transformMatrix.transformInverseDirection(direction);
+	return getTransform().transformInverseDirection(direction);
 }
 
 void RigidBody::setCanSleep(const bool canSleep)
 {
-	RigidBody::canSleep = canSleep;
+	store->canSleep[slot] = canSleep;
 
-	if (!canSleep && !isAwake) setAwake();
+	if (!canSleep && !getAwake()) setAwake();
 }
 
 void RigidBody::getLastFrameAcceleration(Vector3 *acceleration) const
 {
-	*acceleration = lastFrameAcceleration;
+	*acceleration = store->lastFrameAcceleration.get(slot);
 }
 
 Vector3 RigidBody::getLastFrameAcceleration() const
 {
-	return lastFrameAcceleration;
-}
\ No newline at end of file
+	return store->lastFrameAcceleration.get(slot);
+}
+
+Vector3 RigidBody::getInterpolatedPosition(real alpha) const
+{
+	Vector3 last = store->lastPosition.get(slot);
+	return last + (getPosition() - last) * alpha;
+}
+
+Quaternion RigidBody::getInterpolatedOrientation(real alpha) const
+{
+	Quaternion last = store->lastOrientation.get(slot);
+	Quaternion current = getOrientation();
+
+	// q and -q are the same orientation, so blend with whichever is nearer
+	real dot = last.r*current.r + last.i*current.i + last.j*current.j + last.k*current.k;
+	real lastWeight = dot < 0 ? alpha - 1 : 1 - alpha;
+
+	Quaternion result(last.r*lastWeight + current.r*alpha,
+		last.i*lastWeight + current.i*alpha,
+		last.j*lastWeight + current.j*alpha,
+		last.k*lastWeight + current.k*alpha);
+	result.normalize();
+	return result;
+}
+
+unsigned BodyIndex::get(const RigidBody* body) const
+{
+	if (body->getStore() == store)
+	{
+		unsigned slot = body->getSlot();
+		return slot < slots.size() ? slots[slot] : NO_BODY_INDEX;
+	}
+
+	auto found = others.find(body);
+	return found == others.end() ? NO_BODY_INDEX : found->second;
+}
+
+void BodyIndex::set(const RigidBody* body, unsigned value)
+{
+	if (setCount == 0) store = body->getStore();
+	if (get(body) == NO_BODY_INDEX) setCount++;
+
+	if (body->getStore() == store)
+	{
+		unsigned slot = body->getSlot();
+		if (slot >= slots.size()) slots.resize(store->getBodyCount(), NO_BODY_INDEX);
+		slots[slot] = value;
+	}
+	else
+	{
+		others[body] = value;
+	}
+}
+
+void BodyIndex::clear(const RigidBody* body)
+{
+	if (get(body) == NO_BODY_INDEX) return;
+	setCount--;
+
+	if (body->getStore() == store) slots[body->getSlot()] = NO_BODY_INDEX;
+	else others.erase(body);
+}
@@ -0,0 +1,568 @@
+#include <crystal\body.h>
+#include <crystal\workers.h>
+#include <algorithm>
+#ifdef CRYSTAL_USE_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace crystal;
+
+bool BodyStore::useSSE = true;
+
+/**
+* Handles one body at a time. The loops over the store are written
+* once for a lane type, so the scalar and the SSE versions do the
+* same arithmetic in the same order and give the same result.
+*/
+struct ScalarLanes
+{
+	typedef real Value;
+	typedef bool Mask;
+
+	static const unsigned count = 1;
+
+	static Value load(const std::vector<real>& column, unsigned i)
+	{
+		return column[i];
+	}
+
+	static void store(std::vector<real>& column, unsigned i, Value value, Mask mask)
+	{
+		if (mask) column[i] = value;
+	}
+
+	static Mask getMask(const std::vector<unsigned char>& flags, unsigned i)
+	{
+		return flags[i] != 0;
+	}
+
+	static Mask all()
+	{
+		return true;
+	}
+
+	static Mask both(Mask a, Mask b)
+	{
+		return a && b;
+	}
+
+	//Gets the value, or the limit if the value is larger
+	static Value limit(Value value, Value limit)
+	{
+		return value > limit ? limit : value;
+	}
+};
+
+#ifdef CRYSTAL_USE_SSE
+//Holds a real for each of four bodies, with the arithmetic of a real
+struct Lanes
+{
+	__m128 v;
+
+	Lanes() {}
+	Lanes(__m128 v) :v(v) {}
+	Lanes(real value) :v(_mm_set1_ps(value)) {}
+};
+
+static inline Lanes operator+(Lanes a, Lanes b) { return _mm_add_ps(a.v, b.v); }
+static inline Lanes operator-(Lanes a, Lanes b) { return _mm_sub_ps(a.v, b.v); }
+static inline Lanes operator*(Lanes a, Lanes b) { return _mm_mul_ps(a.v, b.v); }
+
+//Handles four bodies at a time with SSE
+struct SSELanes
+{
+	typedef Lanes Value;
+	typedef __m128 Mask;
+
+	static const unsigned count = BODY_STORE_LANES;
+
+	static Value load(const std::vector<real>& column, unsigned i)
+	{
+		return _mm_loadu_ps(&column[i]);
+	}
+
+	static void store(std::vector<real>& column, unsigned i, Value value, Mask mask)
+	{
+		__m128 old = _mm_loadu_ps(&column[i]);
+		_mm_storeu_ps(&column[i], _mm_or_ps(_mm_and_ps(mask, value.v), _mm_andnot_ps(mask, old)));
+	}
+
+	static Mask getMask(const std::vector<unsigned char>& flags, unsigned i)
+	{
+		return _mm_castsi128_ps(_mm_set_epi32(
+			flags[i + 3] ? -1 : 0, flags[i + 2] ? -1 : 0, flags[i + 1] ? -1 : 0, flags[i] ? -1 : 0));
+	}
+
+	static Mask all()
+	{
+		return _mm_castsi128_ps(_mm_set1_epi32(-1));
+	}
+
+	static Mask both(Mask a, Mask b)
+	{
+		return _mm_and_ps(a, b);
+	}
+
+	static Value limit(Value value, Value limit)
+	{
+		return _mm_min_ps(limit.v, value.v);
+	}
+};
+#endif
+
+/**
+* Creates a transform matrix from a position and orientation.
+*/
+template<class T>
+static inline void _calculateTransformMatrix(T transformMatrix[12],
+	const T position[3],
+	const T orientation[4])
+{
+	const T& r = orientation[0];
+	const T& i = orientation[1];
+	const T& j = orientation[2];
+	const T& k = orientation[3];
+
+	transformMatrix[0] = 1 - 2 * j*j - 2 * k*k;
+	transformMatrix[1] = 2 * i*j - 2 * r*k;
+	transformMatrix[2] = 2 * i*k + 2 * r*j;
+	transformMatrix[3] = position[0];
+
+	transformMatrix[4] = 2 * i*j + 2 * r*k;
+	transformMatrix[5] = 1 - 2 * i*i - 2 * k*k;
+	transformMatrix[6] = 2 * j*k - 2 * r*i;
+	transformMatrix[7] = position[1];
+
+	transformMatrix[8] = 2 * i*k - 2 * r*j;
+	transformMatrix[9] = 2 * j*k + 2 * r*i;
+	transformMatrix[10] = 1 - 2 * i*i - 2 * j*j;
+	transformMatrix[11] = position[2];
+}
+
+/**
+* Internal function to do an intertia tensor transform by a quaternion.
+* Note that the implementation of this function was created by an
+* automated code-generator and optimizer.
+*/
+template<class T>
+static inline void _transformInertiaTensor(T iitWorld[9],
+	const T iitBody[9],
+	const T rotmat[12])
+{
+	T t4 = rotmat[0] * iitBody[0] +
+		rotmat[1] * iitBody[3] +
+		rotmat[2] * iitBody[6];
+	T t9 = rotmat[0] * iitBody[1] +
+		rotmat[1] * iitBody[4] +
+		rotmat[2] * iitBody[7];
+	T t14 = rotmat[0] * iitBody[2] +
+		rotmat[1] * iitBody[5] +
+		rotmat[2] * iitBody[8];
+	T t28 = rotmat[4] * iitBody[0] +
+		rotmat[5] * iitBody[3] +
+		rotmat[6] * iitBody[6];
+	T t33 = rotmat[4] * iitBody[1] +
+		rotmat[5] * iitBody[4] +
+		rotmat[6] * iitBody[7];
+	T t38 = rotmat[4] * iitBody[2] +
+		rotmat[5] * iitBody[5] +
+		rotmat[6] * iitBody[8];
+	T t52 = rotmat[8] * iitBody[0] +
+		rotmat[9] * iitBody[3] +
+		rotmat[10] * iitBody[6];
+	T t57 = rotmat[8] * iitBody[1] +
+		rotmat[9] * iitBody[4] +
+		rotmat[10] * iitBody[7];
+	T t62 = rotmat[8] * iitBody[2] +
+		rotmat[9] * iitBody[5] +
+		rotmat[10] * iitBody[8];
+
+	iitWorld[0] = t4*rotmat[0] +
+		t9*rotmat[1] +
+		t14*rotmat[2];
+	iitWorld[1] = t4*rotmat[4] +
+		t9*rotmat[5] +
+		t14*rotmat[6];
+	iitWorld[2] = t4*rotmat[8] +
+		t9*rotmat[9] +
+		t14*rotmat[10];
+	iitWorld[3] = t28*rotmat[0] +
+		t33*rotmat[1] +
+		t38*rotmat[2];
+	iitWorld[4] = t28*rotmat[4] +
+		t33*rotmat[5] +
+		t38*rotmat[6];
+	iitWorld[5] = t28*rotmat[8] +
+		t33*rotmat[9] +
+		t38*rotmat[10];
+	iitWorld[6] = t52*rotmat[0] +
+		t57*rotmat[1] +
+		t62*rotmat[2];
+	iitWorld[7] = t52*rotmat[4] +
+		t57*rotmat[5] +
+		t62*rotmat[6];
+	iitWorld[8] = t52*rotmat[8] +
+		t57*rotmat[9] +
+		t62*rotmat[10];
+}
+
+BodyStore::BodyStore() :dragDuration(0)
+{
+	std::vector<real>* vectors[] = {
+		&position.x, &position.y, &position.z,
+		&velocity.x, &velocity.y, &velocity.z,
+		&acceleration.x, &acceleration.y, &acceleration.z,
+		&rotation.x, &rotation.y, &rotation.z,
+		&forceAccum.x, &forceAccum.y, &forceAccum.z,
+		&torqueAccum.x, &torqueAccum.y, &torqueAccum.z,
+		&lastFrameAcceleration.x, &lastFrameAcceleration.y, &lastFrameAcceleration.z,
+		&orientation.r, &orientation.i, &orientation.j, &orientation.k,
+		&inverseMass, &linearDamping, &angularDamping, &linearDrag, &angularDrag,
+		&linearFactor, &angularFactor, &motion,
+		&lastPosition.x, &lastPosition.y, &lastPosition.z,
+		&lastOrientation.r, &lastOrientation.i, &lastOrientation.j, &lastOrientation.k
+	};
+	columns.assign(vectors, vectors + sizeof(vectors) / sizeof(vectors[0]));
+	for (unsigned n = 0; n < 9; n++)
+	{
+		columns.push_back(&inverseInertiaTensor.data[n]);
+		columns.push_back(&inverseInertiaTensorWorld.data[n]);
+	}
+	for (unsigned n = 0; n < 12; n++)
+	{
+		columns.push_back(&transformMatrix.data[n]);
+	}
+}
+
+BodyStore::~BodyStore()
+{
+	BodyStore& loose = getLooseStore();
+	while (!bodies.empty())
+	{
+		loose.adopt(bodies.back());
+	}
+}
+
+BodyStore& BodyStore::getLooseStore()
+{
+	// Never destroyed, so a world torn down with the statics can still
+	// hand its bodies over, whatever order the statics go in
+	static BodyStore* loose = new BodyStore();
+	return *loose;
+}
+
+void BodyStore::add(RigidBody* body)
+{
+	unsigned slot = bodies.size();
+	for (auto column : columns)
+	{
+		column->push_back(0);
+	}
+	isAwake.push_back(1);
+	canSleep.push_back(1);
+	bodies.push_back(body);
+
+	orientation.set(slot, Quaternion());
+	lastOrientation.set(slot, Quaternion());
+	transformMatrix.set(slot, Matrix4());
+	linearDrag[slot] = real_pow(linearDamping[slot], dragDuration);
+	angularDrag[slot] = real_pow(angularDamping[slot], dragDuration);
+	linearFactor[slot] = angularFactor[slot] = 1;
+	motion[slot] = sleepEpsilon*2.0f;
+
+	body->store = this;
+	body->slot = slot;
+}
+
+void BodyStore::remove(RigidBody* body)
+{
+	unsigned slot = body->slot;
+	unsigned last = bodies.size() - 1;
+	if (slot != last)
+	{
+		for (auto column : columns)
+		{
+			(*column)[slot] = (*column)[last];
+		}
+		isAwake[slot] = isAwake[last];
+		canSleep[slot] = canSleep[last];
+		bodies[slot] = bodies[last];
+		bodies[slot]->slot = slot;
+	}
+
+	for (auto column : columns)
+	{
+		column->pop_back();
+	}
+	isAwake.pop_back();
+	canSleep.pop_back();
+	bodies.pop_back();
+}
+
+void BodyStore::copySlot(unsigned slot, const BodyStore& from, unsigned fromSlot)
+{
+	for (unsigned n = 0; n < columns.size(); n++)
+	{
+		(*columns[n])[slot] = (*from.columns[n])[fromSlot];
+	}
+	isAwake[slot] = from.isAwake[fromSlot];
+	canSleep[slot] = from.canSleep[fromSlot];
+
+	// The drag of the other store may be for another duration
+	linearDrag[slot] = real_pow(linearDamping[slot], dragDuration);
+	angularDrag[slot] = real_pow(angularDamping[slot], dragDuration);
+}
+
+void BodyStore::adopt(RigidBody* body)
+{
+	BodyStore* from = body->store;
+	if (from == this) return;
+
+	unsigned fromSlot = body->slot;
+	add(body);
+	if (from)
+	{
+		copySlot(body->slot, *from, fromSlot);
+
+		// Removing goes by the body's slot, so point it back for now
+		unsigned slot = body->slot;
+		body->slot = fromSlot;
+		from->remove(body);
+		body->slot = slot;
+	}
+	body->store = this;
+}
+
+void BodyStore::updateDrag(real duration)
+{
+	if (duration == dragDuration) return;
+
+	for (unsigned i = 0; i < bodies.size(); i++)
+	{
+		linearDrag[i] = real_pow(linearDamping[i], duration);
+		angularDrag[i] = real_pow(angularDamping[i], duration);
+	}
+	dragDuration = duration;
+}
+
+template<class L>
+void BodyStore::calculateDerivedDataSlots(unsigned first, bool awakeOnly)
+{
+	typedef typename L::Value T;
+	typename L::Mask awake = awakeOnly ? L::getMask(isAwake, first) : L::all();
+
+	T p[3] = { L::load(position.x, first), L::load(position.y, first), L::load(position.z, first) };
+	T q[4] = { L::load(orientation.r, first), L::load(orientation.i, first),
+		L::load(orientation.j, first), L::load(orientation.k, first) };
+	T iitBody[9], iitWorld[9], transform[12];
+	for (unsigned n = 0; n < 9; n++) iitBody[n] = L::load(inverseInertiaTensor.data[n], first);
+
+	_calculateTransformMatrix(transform, p, q);
+	_transformInertiaTensor(iitWorld, iitBody, transform);
+
+	for (unsigned n = 0; n < 12; n++) L::store(transformMatrix.data[n], first, transform[n], awake);
+	for (unsigned n = 0; n < 9; n++) L::store(inverseInertiaTensorWorld.data[n], first, iitWorld[n], awake);
+}
+
+template<class L>
+void BodyStore::integrateSlots(unsigned first, real duration, real bias)
+{
+	typedef typename L::Value T;
+	typename L::Mask awake = L::getMask(isAwake, first);
+
+	T p[3], v[3], w[3], q[4];
+	T invMass = L::load(inverseMass, first);
+	T linearScale = L::load(linearFactor, first);
+	T angularScale = L::load(angularFactor, first);
+	T drag = L::load(linearDrag, first);
+	T angularDragValue = L::load(angularDrag, first);
+	T dt = duration;
+
+	// Update the linear motion
+	std::vector<real>* linear[3][3] = {
+		{ &position.x, &velocity.x, &forceAccum.x },
+		{ &position.y, &velocity.y, &forceAccum.y },
+		{ &position.z, &velocity.z, &forceAccum.z }
+	};
+	const std::vector<real>* accelerations[3] = { &acceleration.x, &acceleration.y, &acceleration.z };
+	for (unsigned c = 0; c < 3; c++)
+	{
+		T a = L::load(*accelerations[c], first) + L::load(*linear[c][2], first) * invMass;
+		v[c] = L::load(*linear[c][1], first);
+		v[c] = v[c] + (a * linearScale) * dt;
+		v[c] = v[c] * drag;
+		p[c] = L::load(*linear[c][0], first);
+		p[c] = p[c] + v[c] * dt;
+	}
+
+	// Get the angular acceleration from the torque, and update the
+	// angular motion
+	T torque[3] = { L::load(torqueAccum.x, first), L::load(torqueAccum.y, first), L::load(torqueAccum.z, first) };
+	T iit[9];
+	for (unsigned n = 0; n < 9; n++) iit[n] = L::load(inverseInertiaTensorWorld.data[n], first);
+	const std::vector<real>* rotations[3] = { &rotation.x, &rotation.y, &rotation.z };
+	for (unsigned c = 0; c < 3; c++)
+	{
+		T angularAcceleration = torque[0] * iit[c * 3] + torque[1] * iit[c * 3 + 1] + torque[2] * iit[c * 3 + 2];
+		w[c] = L::load(*rotations[c], first);
+		w[c] = w[c] + (angularAcceleration * angularScale) * dt;
+		w[c] = w[c] * angularDragValue;
+	}
+
+	// Update the orientation, the same way as Quaternion::addScaledVector
+	q[0] = L::load(orientation.r, first);
+	q[1] = L::load(orientation.i, first);
+	q[2] = L::load(orientation.j, first);
+	q[3] = L::load(orientation.k, first);
+	T sx = w[0] * dt, sy = w[1] * dt, sz = w[2] * dt;
+	T dr = T(0) * q[0] - sx * q[1] - sy * q[2] - sz * q[3];
+	T di = dr * q[1] + sx * q[0] + sy * q[3] - sz * q[2];
+	T dj = dr * q[2] - di * q[3] + sy * q[0] + sz * q[1];
+	T dk = dr * q[3] + di * q[2] - dj * q[1] + sz * q[0];
+	q[0] = q[0] + dr * T((real)0.5);
+	q[1] = q[1] + di * T((real)0.5);
+	q[2] = q[2] + dj * T((real)0.5);
+	q[3] = q[3] + dk * T((real)0.5);
+
+	for (unsigned c = 0; c < 3; c++)
+	{
+		L::store(*linear[c][0], first, p[c], awake);
+		L::store(*linear[c][1], first, v[c], awake);
+	}
+	L::store(rotation.x, first, w[0], awake);
+	L::store(rotation.y, first, w[1], awake);
+	L::store(rotation.z, first, w[2], awake);
+	L::store(orientation.r, first, q[0], awake);
+	L::store(orientation.i, first, q[1], awake);
+	L::store(orientation.j, first, q[2], awake);
+	L::store(orientation.k, first, q[3], awake);
+
+	// Update the matrices with the new position and orientation
+	calculateDerivedDataSlots<L>(first, true);
+
+	// Clear both accumulators
+	T zero = T((real)0);
+	for (unsigned c = 0; c < 3; c++)
+	{
+		L::store(*linear[c][2], first, zero, awake);
+	}
+	L::store(torqueAccum.x, first, zero, awake);
+	L::store(torqueAccum.y, first, zero, awake);
+	L::store(torqueAccum.z, first, zero, awake);
+
+	// Update the kinetic energy store. The world puts the body to
+	// sleep when it stays low.
+	T currentMotion = (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]) +
+		(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+	T newMotion = T(bias) * L::load(motion, first) + T(1 - bias) * currentMotion;
+	newMotion = L::limit(newMotion, T(10 * sleepEpsilon));
+	L::store(motion, first, newMotion, L::both(awake, L::getMask(canSleep, first)));
+}
+
+void BodyStore::integrateRange(unsigned first, unsigned last, real duration)
+{
+	real bias = real_pow(0.5, duration);
+	unsigned i = first;
+#ifdef CRYSTAL_USE_SSE
+	if (useSSE)
+	{
+		for (; i + SSELanes::count <= last; i += SSELanes::count)
+		{
+			integrateSlots<SSELanes>(i, duration, bias);
+		}
+	}
+#endif
+	for (; i < last; i++)
+	{
+		// Sleeping bodies don't move
+		if (!isAwake[i]) continue;
+		integrateSlots<ScalarLanes>(i, duration, bias);
+	}
+}
+
+void BodyStore::calculateDerivedDataRange(unsigned first, unsigned last, bool awakeOnly)
+{
+	unsigned i = first;
+#ifdef CRYSTAL_USE_SSE
+	if (useSSE)
+	{
+		for (; i + SSELanes::count <= last; i += SSELanes::count)
+		{
+			calculateDerivedDataSlots<SSELanes>(i, awakeOnly);
+		}
+	}
+#endif
+	for (; i < last; i++)
+	{
+		calculateDerivedDataSlots<ScalarLanes>(i, awakeOnly);
+	}
+}
+
+void BodyStore::startFrameRange(unsigned first, unsigned last)
+{
+	for (auto column : { &forceAccum.x, &forceAccum.y, &forceAccum.z, &torqueAccum.x, &torqueAccum.y, &torqueAccum.z })
+	{
+		std::fill(column->begin() + first, column->begin() + last, (real)0);
+	}
+	calculateDerivedDataRange(first, last, true);
+}
+
+void BodyStore::integrate(real duration, WorkerPool* workers)
+{
+	updateDrag(duration);
+	if (!workers)
+	{
+		integrateRange(0, bodies.size(), duration);
+		return;
+	}
+
+	workers->runRange(bodies.size(), BODY_STORE_SLOTS_PER_TASK, [&](unsigned first, unsigned last)
+	{
+		integrateRange(first, last, duration);
+	}, BODY_STORE_LANES);
+}
+
+void BodyStore::startFrame(WorkerPool* workers)
+{
+	if (!workers)
+	{
+		startFrameRange(0, bodies.size());
+		return;
+	}
+
+	workers->runRange(bodies.size(), BODY_STORE_SLOTS_PER_TASK, [&](unsigned first, unsigned last)
+	{
+		startFrameRange(first, last);
+	}, BODY_STORE_LANES);
+}
+
+void BodyStore::saveStateRange(unsigned first, unsigned last)
+{
+	std::vector<real>* from[] = { &position.x, &position.y, &position.z,
+		&orientation.r, &orientation.i, &orientation.j, &orientation.k };
+	std::vector<real>* to[] = { &lastPosition.x, &lastPosition.y, &lastPosition.z,
+		&lastOrientation.r, &lastOrientation.i, &lastOrientation.j, &lastOrientation.k };
+	for (unsigned n = 0; n < 7; n++)
+	{
+		std::copy(from[n]->begin() + first, from[n]->begin() + last, to[n]->begin() + first);
+	}
+}
+
+void BodyStore::saveState(WorkerPool* workers)
+{
+	if (!workers)
+	{
+		saveStateRange(0, bodies.size());
+		return;
+	}
+
+	workers->runRange(bodies.size(), BODY_STORE_SLOTS_PER_TASK, [&](unsigned first, unsigned last)
+	{
+		saveStateRange(first, last);
+	}, BODY_STORE_LANES);
+}
+
+void BodyStore::saveState(RigidBody* body)
+{
+	saveStateRange(body->slot, body->slot + 1);
+}
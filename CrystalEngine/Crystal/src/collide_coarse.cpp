@@ -52,4 +52,625 @@ real BoundingSphere::getGrowth(const BoundingSphere& other) const
 	BoundingSphere newSphere = BoundingSphere{ *this,other };
 	// return newSphere.radius*newSphere.radius - radius*radius;
 	return newSphere.radius - radius;
-}
\ No newline at end of file
+}
+
+BoundingBox::BoundingBox(const BoundingBox& b1, const BoundingBox& b2)
+{
+	Vector3 min1 = b1.getMin(), max1 = b1.getMax();
+	Vector3 min2 = b2.getMin(), max2 = b2.getMax();
+	Vector3 min(
+		min1.x < min2.x ? min1.x : min2.x,
+		min1.y < min2.y ? min1.y : min2.y,
+		min1.z < min2.z ? min1.z : min2.z);
+	Vector3 max(
+		max1.x > max2.x ? max1.x : max2.x,
+		max1.y > max2.y ? max1.y : max2.y,
+		max1.z > max2.z ? max1.z : max2.z);
+	center = (min + max) * ((real)0.5);
+	halfSize = (max - min) * ((real)0.5);
+}
+
+bool BoundingBox::fromPrimitive(const CollisionPrimitive& primitive, BoundingBox* box)
+{
+	const Matrix4& transform = primitive.getTransform();
+	switch (primitive.getShapeType())
+	{
+	case BOX_TAG:
+	{
+		const Vector3& halfSize = static_cast<const CollisionBox&>(primitive).halfSize;
+		// The extent along each world axis is the sum of the
+		// projections of the three box axes onto that axis.
+		box->center = transform.getAxisVector(3);
+		box->halfSize = Vector3(
+			real_abs(transform.data[0]) * halfSize.x + real_abs(transform.data[1]) * halfSize.y + real_abs(transform.data[2]) * halfSize.z,
+			real_abs(transform.data[4]) * halfSize.x + real_abs(transform.data[5]) * halfSize.y + real_abs(transform.data[6]) * halfSize.z,
+			real_abs(transform.data[8]) * halfSize.x + real_abs(transform.data[9]) * halfSize.y + real_abs(transform.data[10]) * halfSize.z);
+		return true;
+	}
+	case SPHERE_TAG:
+	{
+		real radius = static_cast<const CollisionSphere&>(primitive).radius;
+		box->center = transform.getAxisVector(3);
+		box->halfSize = Vector3(radius, radius, radius);
+		return true;
+	}
+	default:
+		// Planes (and unknown colliders) have no finite bounds
+		return false;
+	}
+}
+
+bool BoundingBox::contains(const BoundingBox& other) const
+{
+	Vector3 min = getMin(), max = getMax();
+	Vector3 otherMin = other.getMin(), otherMax = other.getMax();
+	return min.x <= otherMin.x && min.y <= otherMin.y && min.z <= otherMin.z &&
+		max.x >= otherMax.x && max.y >= otherMax.y && max.z >= otherMax.z;
+}
+
+real BoundingBox::getGrowth(const BoundingBox& other) const
+{
+	BoundingBox newBox = BoundingBox{ *this,other };
+	return newBox.getSize() - getSize();
+}
+
+void BruteForceBroadphase::add(CollisionPrimitive* collider)
+{
+	colliders.push_back(collider);
+}
+
+void BruteForceBroadphase::remove(CollisionPrimitive* collider)
+{
+	for (auto itor = colliders.begin(); itor != colliders.end(); itor++)
+	{
+		if (*itor == collider)
+		{
+			colliders.erase(itor);
+			return;
+		}
+	}
+}
+
+void BruteForceBroadphase::getPotentialContacts(std::vector<PotentialContact>& contacts)
+{
+	PotentialContact contact;
+	for (unsigned i = 0; i < colliders.size(); i++)
+	{
+		contact.collider[0] = colliders[i];
+		for (unsigned j = i + 1; j < colliders.size(); j++)
+		{
+			contact.collider[1] = colliders[j];
+			contacts.push_back(contact);
+		}
+	}
+}
+
+AABBTreeBroadphase::~AABBTreeBroadphase()
+{
+	// Deleting the root deletes the whole tree
+	delete root;
+}
+
+void AABBTreeBroadphase::add(CollisionPrimitive* collider)
+{
+	BoundingBox box;
+	if (!BoundingBox::fromPrimitive(*collider, &box))
+	{
+		unbounded.push_back(collider);
+		return;
+	}
+	box.fatten(margin);
+
+	Node* leaf = new Node(NULL, box, collider);
+	leafIndex[collider] = leaves.size();
+	leaves.push_back(leaf);
+	root = root ? root->insert(leaf) : leaf;
+}
+
+void AABBTreeBroadphase::remove(CollisionPrimitive* collider)
+{
+	auto found = leafIndex.find(collider);
+	if (found == leafIndex.end())
+	{
+		for (auto itor = unbounded.begin(); itor != unbounded.end(); itor++)
+		{
+			if (*itor == collider)
+			{
+				unbounded.erase(itor);
+				return;
+			}
+		}
+		return;
+	}
+
+	unsigned index = found->second;
+	Node* leaf = leaves[index];
+	root = leaf->detach();
+	delete leaf;
+
+	// Swap the last leaf into the freed slot
+	leaves[index] = leaves.back();
+	leafIndex[leaves[index]->collider] = index;
+	leaves.pop_back();
+	leafIndex.erase(collider);
+}
+
+void AABBTreeBroadphase::update()
+{
+	BoundingBox box;
+	for (Node* leaf : leaves)
+	{
+		BoundingBox::fromPrimitive(*leaf->collider, &box);
+		// Still inside the enlarged volume, nothing to do
+		if (leaf->volume.contains(box)) continue;
+
+		box.fatten(margin);
+		root = leaf->detach();
+		leaf->volume = box;
+		root = root ? root->insert(leaf) : leaf;
+	}
+}
+
+void AABBTreeBroadphase::query(const BoundingBox& box, std::vector<CollisionPrimitive*>& result) const
+{
+	if (root) root->query(box, result);
+	result.insert(result.end(), unbounded.begin(), unbounded.end());
+}
+
+void AABBTreeBroadphase::getPotentialContacts(std::vector<PotentialContact>& contacts)
+{
+	if (root) root->getPotentialContacts(contacts);
+
+	// Colliders without bounds may touch anything
+	PotentialContact contact;
+	for (unsigned i = 0; i < unbounded.size(); i++)
+	{
+		contact.collider[0] = unbounded[i];
+		for (unsigned j = i + 1; j < unbounded.size(); j++)
+		{
+			contact.collider[1] = unbounded[j];
+			contacts.push_back(contact);
+		}
+		for (Node* leaf : leaves)
+		{
+			contact.collider[1] = leaf->collider;
+			contacts.push_back(contact);
+		}
+	}
+}
+
+void SweepAndPruneBroadphase::addPair(unsigned a, unsigned b)
+{
+	// Only pairs that overlap on every axis are recorded
+	if (!proxies[a].overlaps(proxies[b])) return;
+	if (!pairs.insert(pairKey(a, b)).second) return;
+	proxies[a].partners.push_back(b);
+	proxies[b].partners.push_back(a);
+
+	PotentialContact contact;
+	contact.collider[0] = proxies[a].collider;
+	contact.collider[1] = proxies[b].collider;
+	addedPairs.push_back(contact);
+}
+
+void SweepAndPruneBroadphase::removePair(unsigned a, unsigned b)
+{
+	if (pairs.erase(pairKey(a, b)) == 0) return;
+	removePartner(a, b);
+	removePartner(b, a);
+
+	PotentialContact contact;
+	contact.collider[0] = proxies[a].collider;
+	contact.collider[1] = proxies[b].collider;
+	removedPairs.push_back(contact);
+}
+
+void SweepAndPruneBroadphase::removePartner(unsigned proxy, unsigned partner)
+{
+	std::vector<unsigned>& partners = proxies[proxy].partners;
+	for (unsigned i = 0; i < partners.size(); i++)
+	{
+		if (partners[i] != partner) continue;
+		partners[i] = partners.back();
+		partners.pop_back();
+		return;
+	}
+}
+
+unsigned SweepAndPruneBroadphase::findEndPoint(unsigned axis, unsigned proxy, bool isMin) const
+{
+	// The end points hold the bounds of the proxies, so the one wanted is
+	// among those with the same value
+	const std::vector<EndPoint>& points = endPoints[axis];
+	real value = isMin ? proxies[proxy].min[axis] : proxies[proxy].max[axis];
+	auto itor = std::lower_bound(points.begin(), points.end(), value,
+		[](const EndPoint& point, real value) { return point.value < value; });
+	for (; itor != points.end(); itor++)
+	{
+		if (itor->proxy == proxy && itor->isMin == isMin) break;
+	}
+	return (unsigned)(itor - points.begin());
+}
+
+void SweepAndPruneBroadphase::sortAxis(unsigned axis)
+{
+	std::vector<EndPoint>& points = endPoints[axis];
+	for (unsigned i = 1; i < points.size(); i++)
+	{
+		EndPoint point = points[i];
+		unsigned j = i;
+		// Move the end point down while it is smaller than the one before it.
+		// At equal values a min point goes before a max point, so touching
+		// bounds count as overlapping.
+		while (j > 0 && (point.value < points[j - 1].value ||
+			(point.value == points[j - 1].value && point.isMin && !points[j - 1].isMin)))
+		{
+			const EndPoint& other = points[j - 1];
+			if (point.isMin && !other.isMin)
+			{
+				// A min passing a max: the two may have started overlapping
+				addPair(point.proxy, other.proxy);
+			}
+			else if (!point.isMin && other.isMin)
+			{
+				// A max passing a min: the two no longer overlap
+				removePair(point.proxy, other.proxy);
+			}
+			points[j] = other;
+			j--;
+		}
+		points[j] = point;
+	}
+}
+
+void SweepAndPruneBroadphase::add(CollisionPrimitive* collider)
+{
+	BoundingBox box;
+	if (!BoundingBox::fromPrimitive(*collider, &box))
+	{
+		unbounded.push_back(collider);
+		return;
+	}
+
+	unsigned index;
+	if (freeProxies.empty())
+	{
+		index = proxies.size();
+		proxies.push_back(Proxy());
+	}
+	else
+	{
+		index = freeProxies.back();
+		freeProxies.pop_back();
+	}
+	box.fatten(margin);
+	proxies[index].collider = collider;
+	proxies[index].setBounds(box);
+	proxyIndex[collider] = index;
+
+	// Append the end points and let the sort put them in place, which
+	// also finds the pairs of the new collider
+	const Vector3& min = proxies[index].min;
+	const Vector3& max = proxies[index].max;
+	for (unsigned axis = 0; axis < 3; axis++)
+	{
+		EndPoint point;
+		point.proxy = index;
+		point.value = min[axis];
+		point.isMin = true;
+		endPoints[axis].push_back(point);
+		point.value = max[axis];
+		point.isMin = false;
+		endPoints[axis].push_back(point);
+		sortAxis(axis);
+	}
+}
+
+void SweepAndPruneBroadphase::remove(CollisionPrimitive* collider)
+{
+	auto found = proxyIndex.find(collider);
+	if (found == proxyIndex.end())
+	{
+		for (auto itor = unbounded.begin(); itor != unbounded.end(); itor++)
+		{
+			if (*itor == collider)
+			{
+				unbounded.erase(itor);
+				return;
+			}
+		}
+		return;
+	}
+
+	unsigned index = found->second;
+	proxyIndex.erase(found);
+
+	// The max end point comes after the min one, so it is erased first
+	for (unsigned axis = 0; axis < 3; axis++)
+	{
+		std::vector<EndPoint>& points = endPoints[axis];
+		points.erase(points.begin() + findEndPoint(axis, index, false));
+		points.erase(points.begin() + findEndPoint(axis, index, true));
+	}
+
+	// Only the pairs of the removed proxy are visited
+	while (!proxies[index].partners.empty())
+	{
+		removePair(index, proxies[index].partners.back());
+	}
+
+	proxies[index].collider = NULL;
+	freeProxies.push_back(index);
+}
+
+void SweepAndPruneBroadphase::update()
+{
+	BoundingBox box;
+	for (Proxy& proxy : proxies)
+	{
+		if (!proxy.collider) continue;
+		BoundingBox::fromPrimitive(*proxy.collider, &box);
+		box.fatten(margin);
+		proxy.setBounds(box);
+	}
+
+	for (unsigned axis = 0; axis < 3; axis++)
+	{
+		for (EndPoint& point : endPoints[axis])
+		{
+			const Proxy& proxy = proxies[point.proxy];
+			point.value = point.isMin ? proxy.min[axis] : proxy.max[axis];
+		}
+		sortAxis(axis);
+	}
+}
+
+void SweepAndPruneBroadphase::getPotentialContacts(std::vector<PotentialContact>& contacts)
+{
+	PotentialContact contact;
+	for (unsigned long long key : pairs)
+	{
+		contact.collider[0] = proxies[(unsigned)(key >> 32)].collider;
+		contact.collider[1] = proxies[(unsigned)(key & 0xffffffff)].collider;
+		contacts.push_back(contact);
+	}
+
+	// Colliders without bounds may touch anything
+	for (unsigned i = 0; i < unbounded.size(); i++)
+	{
+		contact.collider[0] = unbounded[i];
+		for (unsigned j = i + 1; j < unbounded.size(); j++)
+		{
+			contact.collider[1] = unbounded[j];
+			contacts.push_back(contact);
+		}
+		for (const Proxy& proxy : proxies)
+		{
+			if (!proxy.collider) continue;
+			contact.collider[1] = proxy.collider;
+			contacts.push_back(contact);
+		}
+	}
+}
+
+SpatialGridBroadphase::SpatialGridBroadphase(const Vector3& worldSize, real cellSize, unsigned maxCellsPerCollider)
+	:worldSize(worldSize), cellSize(cellSize), maxCellsPerCollider(maxCellsPerCollider)
+{
+	// Cells that aren't a positive size (or NaN) can't divide the world
+	if (!(this->cellSize > 0)) this->cellSize = DEFAULT_GRID_CELL_SIZE;
+
+	// Don't let the cells get so small that an axis has too many of them
+	for (unsigned axis = 0; axis < 3; axis++)
+	{
+		real smallest = ((real)2.0) * worldSize[axis] / MAX_GRID_CELLS_PER_AXIS;
+		if (this->cellSize < smallest) this->cellSize = smallest;
+	}
+
+	stats = GridStats();
+	stats.cellCount = 1;
+	for (unsigned axis = 0; axis < 3; axis++)
+	{
+		real cells = real_ceil(((real)2.0) * worldSize[axis] / this->cellSize);
+		gridSize[axis] = !(cells >= 1) ? 1 : cells > MAX_GRID_CELLS_PER_AXIS ? MAX_GRID_CELLS_PER_AXIS : (unsigned)cells;
+		stats.cellCount *= gridSize[axis];
+	}
+}
+
+unsigned SpatialGridBroadphase::getCell(real value, unsigned axis) const
+{
+	real cell = real_floor((value + worldSize[axis]) / cellSize);
+	if (cell < 0) return 0;
+	if (cell >= gridSize[axis]) return gridSize[axis] - 1;
+	return (unsigned)cell;
+}
+
+void SpatialGridBroadphase::add(CollisionPrimitive* collider)
+{
+	BoundingBox box;
+	std::vector<CollisionPrimitive*>& list = BoundingBox::fromPrimitive(*collider, &box) ? colliders : unbounded;
+	colliderIndex[collider] = list.size();
+	list.push_back(collider);
+}
+
+void SpatialGridBroadphase::remove(CollisionPrimitive* collider)
+{
+	auto found = colliderIndex.find(collider);
+	if (found == colliderIndex.end()) return;
+
+	// Swap the last collider of its list into the freed slot
+	unsigned index = found->second;
+	std::vector<CollisionPrimitive*>& list =
+		index < colliders.size() && colliders[index] == collider ? colliders : unbounded;
+	list[index] = list.back();
+	colliderIndex[list[index]] = index;
+	list.pop_back();
+	colliderIndex.erase(collider);
+}
+
+void SpatialGridBroadphase::update()
+{
+	proxies.resize(colliders.size());
+	oversized.clear();
+	entries.clear();
+
+	BoundingBox box;
+	for (unsigned i = 0; i < colliders.size(); i++)
+	{
+		Proxy& proxy = proxies[i];
+		proxy.collider = colliders[i];
+		BoundingBox::fromPrimitive(*colliders[i], &box);
+		box.fatten(DEFAULT_AABB_MARGIN);
+		proxy.min = box.getMin();
+		proxy.max = box.getMax();
+
+		unsigned long long cellCount = 1;
+		for (unsigned axis = 0; axis < 3; axis++)
+		{
+			proxy.cellMin[axis] = getCell(proxy.min[axis], axis);
+			proxy.cellMax[axis] = getCell(proxy.max[axis], axis);
+			cellCount *= proxy.cellMax[axis] - proxy.cellMin[axis] + 1;
+		}
+
+		proxy.oversized = cellCount > maxCellsPerCollider;
+		if (proxy.oversized)
+		{
+			oversized.push_back(i);
+			continue;
+		}
+
+		Entry entry;
+		entry.proxy = i;
+		for (unsigned z = proxy.cellMin[2]; z <= proxy.cellMax[2]; z++)
+			for (unsigned y = proxy.cellMin[1]; y <= proxy.cellMax[1]; y++)
+				for (unsigned x = proxy.cellMin[0]; x <= proxy.cellMax[0]; x++)
+				{
+					entry.cell = getCellKey(x, y, z);
+					entries.push_back(entry);
+				}
+	}
+
+	// Use about two buckets per entry, rounded up to a power of two
+	unsigned bucketCount = 64;
+	while (bucketCount < entries.size() * 2) bucketCount <<= 1;
+	unsigned mask = bucketCount - 1;
+
+	// Counting sort the entries by bucket
+	bucketStart.assign(bucketCount + 1, 0);
+	for (const Entry& entry : entries)
+	{
+		bucketStart[getBucket(entry.cell, mask) + 1]++;
+	}
+	for (unsigned i = 0; i < bucketCount; i++)
+	{
+		bucketStart[i + 1] += bucketStart[i];
+	}
+	sortedEntries.resize(entries.size());
+	for (const Entry& entry : entries)
+	{
+		sortedEntries[bucketStart[getBucket(entry.cell, mask)]++] = entry;
+	}
+	// Filling moved every start to the start of the next bucket, shift them back
+	for (unsigned i = bucketCount; i > 0; i--)
+	{
+		bucketStart[i] = bucketStart[i - 1];
+	}
+	bucketStart[0] = 0;
+}
+
+void SpatialGridBroadphase::getPotentialContacts(std::vector<PotentialContact>& contacts)
+{
+	PotentialContact contact;
+
+	stats.occupiedCells = 0;
+	stats.entryCount = entries.size();
+	stats.maxCollidersInCell = 0;
+	stats.oversizedCount = oversized.size();
+
+	for (unsigned bucket = 0; bucket + 1 < bucketStart.size(); bucket++)
+	{
+		unsigned start = bucketStart[bucket];
+		unsigned end = bucketStart[bucket + 1];
+		for (unsigned i = start; i < end; i++)
+		{
+			const Entry& one = sortedEntries[i];
+
+			// Different cells may share a bucket, so only entries of the same cell are paired
+			bool firstInCell = true;
+			for (unsigned j = start; j < i; j++)
+			{
+				if (sortedEntries[j].cell == one.cell)
+				{
+					firstInCell = false;
+					break;
+				}
+			}
+			if (!firstInCell) continue;
+
+			unsigned inCell = 1;
+			for (unsigned j = i + 1; j < end; j++)
+			{
+				const Entry& two = sortedEntries[j];
+				if (two.cell != one.cell) continue;
+				inCell++;
+
+				for (unsigned k = i; k < j; k++)
+				{
+					const Entry& other = sortedEntries[k];
+					if (other.cell != one.cell) continue;
+
+					const Proxy& a = proxies[other.proxy];
+					const Proxy& b = proxies[two.proxy];
+					if (!a.overlaps(b)) continue;
+
+					// Only report the pair in the first cell both colliders cover
+					unsigned first[3];
+					for (unsigned axis = 0; axis < 3; axis++)
+					{
+						first[axis] = a.cellMin[axis] > b.cellMin[axis] ? a.cellMin[axis] : b.cellMin[axis];
+					}
+					if (getCellKey(first[0], first[1], first[2]) != one.cell) continue;
+
+					contact.collider[0] = a.collider;
+					contact.collider[1] = b.collider;
+					contacts.push_back(contact);
+				}
+			}
+
+			stats.occupiedCells++;
+			if (inCell > stats.maxCollidersInCell) stats.maxCollidersInCell = inCell;
+		}
+	}
+	stats.averageCollidersInCell = stats.occupiedCells > 0 ? (real)stats.entryCount / stats.occupiedCells : 0;
+
+	// Colliders too large for the grid are checked against all the others
+	for (unsigned index : oversized)
+	{
+		const Proxy& a = proxies[index];
+		contact.collider[0] = a.collider;
+		for (unsigned j = 0; j < proxies.size(); j++)
+		{
+			const Proxy& b = proxies[j];
+			// Pairs of two oversized colliders are reported once
+			if (b.oversized && j <= index) continue;
+			if (!a.overlaps(b)) continue;
+			contact.collider[1] = b.collider;
+			contacts.push_back(contact);
+		}
+	}
+
+	// Colliders without bounds may touch anything
+	for (unsigned i = 0; i < unbounded.size(); i++)
+	{
+		contact.collider[0] = unbounded[i];
+		for (unsigned j = i + 1; j < unbounded.size(); j++)
+		{
+			contact.collider[1] = unbounded[j];
+			contacts.push_back(contact);
+		}
+		for (CollisionPrimitive* collider : colliders)
+		{
+			contact.collider[1] = collider;
+			contacts.push_back(contact);
+		}
+	}
+}
@@ -1,68 +1,20 @@
 #include <crystal\collide_fine.h>
 #include <assert.h>
+#ifdef CRYSTAL_USE_SSE
+#include <emmintrin.h>
+#endif
 
 using namespace crystal;
 
 unsigned CollisionPrimitive::CurrentId = 0;
 
+bool CollisionDetector::useSSE = true;
+
 unsigned CollisionDetector::primitiveCollide(
 	const CollisionPrimitive& p1,
 	const CollisionPrimitive& p2, CollisionData *data)
 {
-	//TODO: Recfactor
-	unsigned result = 0;
-	if (p1.getTag() == BOX_TAG)
-	{
-		if (p2.getTag() == BOX_TAG)
-		{
-			//Box and box
-			result = boxAndBox((CollisionBox&)p1, (CollisionBox&)p2, data);
-		}
-		else if (p2.getTag() == SPHERE_TAG)
-		{
-			//Box and sphere
-			result = boxAndSphere((CollisionBox&)p1, (CollisionSphere&)p2, data);
-		}
-		else if (p2.getTag() == PLANE_TAG)
-		{
-			//Box and plane
-			result = boxAndHalfSpace((CollisionBox&)p1, (CollisionPlane&)p2, data);
-		}
-	}
-	else if (p1.getTag() == SPHERE_TAG)
-	{
-		if (p2.getTag() == BOX_TAG)
-		{
-			//Box and sphere
-			result = boxAndSphere((CollisionBox&)p2, (CollisionSphere&)p1, data);
-		}
-		else if (p2.getTag() == SPHERE_TAG)
-		{
-			//sphere and sphere
-			result = sphereAndSphere((CollisionSphere&)p2, (CollisionSphere&)p1, data);
-		}
-		else if (p2.getTag() == PLANE_TAG)
-		{
-			//Sphere and plane
-			result = sphereAndHalfSpace((CollisionSphere&)p1, (CollisionPlane&)p2, data);
-		}
-	}
-	else if (p1.getTag() == PLANE_TAG)
-	{
-		if (p2.getTag() == BOX_TAG)
-		{
-			//Box and plane
-			result = boxAndHalfSpace((CollisionBox&)p2, (CollisionPlane&)p1, data);
-		}
-		else if (p2.getTag() == SPHERE_TAG)
-		{
-			//Sphere and plane
-			result = sphereAndHalfSpace((CollisionSphere&)p2, (CollisionPlane&)p1, data);
-		}
-		//No plane and plane collision since a plane can't move
-	}
-
-	return result;
+	return CollisionDispatcher::getFunction(p1.getShapeType(), p2.getShapeType())(p1, p2, data);
 }
 
 void CollisionPrimitive::calculateInternals()
@@ -131,9 +83,14 @@ static inline bool overlapOnAxis(
 	return (distance < oneProject + twoProject);
 }
 
-// This preprocessor definition is only used as a convenience
-// in the boxAndBox intersection  method.
-#define TEST_OVERLAP(axis) overlapOnAxis(one, two, (axis), toCentre)
+static bool findBoxAndBoxAxis(
+	const CollisionBox &one,
+	const CollisionBox &two,
+	const Vector3 &toCentre,
+	real &pen,
+	unsigned &best,
+	unsigned &bestSingleAxis
+);
 
 bool IntersectionTests::boxAndBox(
 	const CollisionBox &one,
@@ -143,30 +100,11 @@ bool IntersectionTests::boxAndBox(
 	// Find the vector between the two centres
 	Vector3 toCentre = two.getAxis(3) - one.getAxis(3);
 
-	return (
-		// Check on box one's axes first
-		TEST_OVERLAP(one.getAxis(0)) &&
-		TEST_OVERLAP(one.getAxis(1)) &&
-		TEST_OVERLAP(one.getAxis(2)) &&
-
-		// And on two's
-		TEST_OVERLAP(two.getAxis(0)) &&
-		TEST_OVERLAP(two.getAxis(1)) &&
-		TEST_OVERLAP(two.getAxis(2)) &&
-
-		// Now on the cross products
-		TEST_OVERLAP(one.getAxis(0) % two.getAxis(0)) &&
-		TEST_OVERLAP(one.getAxis(0) % two.getAxis(1)) &&
-		TEST_OVERLAP(one.getAxis(0) % two.getAxis(2)) &&
-		TEST_OVERLAP(one.getAxis(1) % two.getAxis(0)) &&
-		TEST_OVERLAP(one.getAxis(1) % two.getAxis(1)) &&
-		TEST_OVERLAP(one.getAxis(1) % two.getAxis(2)) &&
-		TEST_OVERLAP(one.getAxis(2) % two.getAxis(0)) &&
-		TEST_OVERLAP(one.getAxis(2) % two.getAxis(1)) &&
-		TEST_OVERLAP(one.getAxis(2) % two.getAxis(2))
-		);
+	// The boxes intersect if none of the 15 axes separates them
+	real pen;
+	unsigned best, bestSingleAxis;
+	return findBoxAndBoxAxis(one, two, toCentre, pen, best, bestSingleAxis);
 }
-#undef TEST_OVERLAP
 
 bool IntersectionTests::boxAndHalfSpace(
 	const CollisionBox &box,
@@ -451,22 +389,25 @@ static inline Vector3 contactPoint(
 // This preprocessor definition is only used as a convenience
 // in the boxAndBox contact generation method.
 #define CHECK_OVERLAP(axis, index) \
-    if (!tryAxis(one, two, (axis), toCentre, (index), pen, best)) return 0;
+    if (!tryAxis(one, two, (axis), toCentre, (index), pen, best)) { best = (index); return false; }
 
-unsigned CollisionDetector::boxAndBox(
+/**
+* Finds the axis of least penetration between two boxes by testing
+* the 15 separating axes one at a time. Returns false as soon as one
+* of them separates the boxes, with best set to that axis.
+*/
+static inline bool findBoxAndBoxAxisScalar(
 	const CollisionBox &one,
 	const CollisionBox &two,
-	CollisionData *data
+	const Vector3 &toCentre,
+	real &pen,
+	unsigned &best,
+	unsigned &bestSingleAxis
 )
 {
-	//if (!IntersectionTests::boxAndBox(one, two)) return 0;
-
-	// Find the vector between the two centres
-	Vector3 toCentre = two.getAxis(3) - one.getAxis(3);
-
 	// We start assuming there is no contact
-	real pen = REAL_MAX;
-	unsigned best = 0xffffff;
+	pen = REAL_MAX;
+	best = 0xffffff;
 
 	// Now we check each axes, returning if it gives us
 	// a separating axis, and keeping track of the axis with
@@ -481,7 +422,7 @@ unsigned CollisionDetector::boxAndBox(
 
 	// Store the best axis-major, in case we run into almost
 	// parallel edge collisions later
-	unsigned bestSingleAxis = best;
+	bestSingleAxis = best;
 
 	CHECK_OVERLAP(one.getAxis(0) % two.getAxis(0), 6);
 	CHECK_OVERLAP(one.getAxis(0) % two.getAxis(1), 7);
@@ -493,6 +434,261 @@ unsigned CollisionDetector::boxAndBox(
 	CHECK_OVERLAP(one.getAxis(2) % two.getAxis(1), 13);
 	CHECK_OVERLAP(one.getAxis(2) % two.getAxis(2), 14);
 
+	return true;
+}
+#undef CHECK_OVERLAP
+
+#ifdef CRYSTAL_USE_SSE
+
+/**
+* Holds the axes of a box splatted across the lanes of SSE registers,
+* so they can be projected onto four candidate axes at once.
+*/
+struct BoxAxesSSE
+{
+	__m128 axis[3][3];
+	__m128 halfSize[3];
+
+	BoxAxesSSE(const CollisionBox &box)
+	{
+		const real* data = box.getTransform().data;
+		for (unsigned i = 0; i < 3; i++)
+		{
+			axis[i][0] = _mm_set1_ps(data[i]);
+			axis[i][1] = _mm_set1_ps(data[4 + i]);
+			axis[i][2] = _mm_set1_ps(data[8 + i]);
+			halfSize[i] = _mm_set1_ps(box.halfSize[i]);
+		}
+	}
+};
+
+static inline __m128 absVector(__m128 v)
+{
+	return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+}
+
+static inline __m128 dotVector(__m128 x1, __m128 y1, __m128 z1, __m128 x2, __m128 y2, __m128 z2)
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x1, x2), _mm_mul_ps(y1, y2)), _mm_mul_ps(z1, z2));
+}
+
+/**
+* The SSE version of transformToAxis, projecting the half-size of the
+* box onto four axes given by their x, y and z components.
+*/
+static inline __m128 transformToAxesSSE(
+	const BoxAxesSSE &box,
+	__m128 x, __m128 y, __m128 z
+)
+{
+	__m128 result = _mm_setzero_ps();
+	for (unsigned i = 0; i < 3; i++)
+	{
+		__m128 projection = dotVector(x, y, z, box.axis[i][0], box.axis[i][1], box.axis[i][2]);
+		result = _mm_add_ps(result, _mm_mul_ps(box.halfSize[i], absVector(projection)));
+	}
+	return result;
+}
+
+/**
+* The SSE version of tryAxis for four axes at once. Axes that are too
+* short to normalize get a penetration of REAL_MAX, so they are never
+* chosen and never separate the boxes.
+*/
+static inline __m128 penetrationOnAxesSSE(
+	const BoxAxesSSE &one,
+	const BoxAxesSSE &two,
+	__m128 x, __m128 y, __m128 z,
+	const __m128 toCentre[3]
+)
+{
+	__m128 squaredLength = dotVector(x, y, z, x, y, z);
+	__m128 valid = _mm_cmpge_ps(squaredLength, _mm_set1_ps(0.0001f));
+
+	__m128 distance = absVector(dotVector(x, y, z, toCentre[0], toCentre[1], toCentre[2]));
+	__m128 penetration = _mm_sub_ps(
+		_mm_add_ps(transformToAxesSSE(one, x, y, z), transformToAxesSSE(two, x, y, z)), distance);
+	penetration = _mm_div_ps(penetration, _mm_sqrt_ps(_mm_max_ps(squaredLength, _mm_set1_ps(0.0001f))));
+
+	return _mm_or_ps(_mm_and_ps(valid, penetration), _mm_andnot_ps(valid, _mm_set1_ps(REAL_MAX)));
+}
+
+/**
+* Finds the axis of least penetration between two boxes with SSE.
+*
+* The rows of a box transform hold the x, y and z components of its
+* three axes, so loading them gives the face axes of a box three to a
+* register. The nine edge axes are built the same way, one axis of box
+* one crossed with the three axes of box two. The 15 axes are then
+* projected in five vector passes, with the same arithmetic as the
+* scalar path.
+*/
+static inline bool findBoxAndBoxAxisSSE(
+	const CollisionBox &one,
+	const CollisionBox &two,
+	const Vector3 &toCentre,
+	real &pen,
+	unsigned &best,
+	unsigned &bestSingleAxis
+)
+{
+	const real* a = one.getTransform().data;
+	const real* b = two.getTransform().data;
+
+	// Clear the position held in the last lane of each row, which
+	// leaves a zero length axis there
+	const __m128 xyzMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	__m128 aRow[3], bRow[3];
+	for (unsigned i = 0; i < 3; i++)
+	{
+		aRow[i] = _mm_and_ps(_mm_loadu_ps(a + 4 * i), xyzMask);
+		bRow[i] = _mm_and_ps(_mm_loadu_ps(b + 4 * i), xyzMask);
+	}
+
+	BoxAxesSSE oneAxes(one), twoAxes(two);
+	__m128 centre[3] = {
+		_mm_set1_ps(toCentre.x), _mm_set1_ps(toCentre.y), _mm_set1_ps(toCentre.z)
+	};
+
+	// Penetrations are stored in the order of the scalar path. Each
+	// store spills one lane into the next slot, which the following
+	// store overwrites.
+	real penetrations[16];
+
+	__m128 penetration = penetrationOnAxesSSE(oneAxes, twoAxes, aRow[0], aRow[1], aRow[2], centre);
+	__m128 separated = _mm_cmplt_ps(penetration, _mm_setzero_ps());
+	_mm_storeu_ps(penetrations, penetration);
+
+	penetration = penetrationOnAxesSSE(oneAxes, twoAxes, bRow[0], bRow[1], bRow[2], centre);
+	separated = _mm_or_ps(separated, _mm_cmplt_ps(penetration, _mm_setzero_ps()));
+	_mm_storeu_ps(penetrations + 3, penetration);
+
+	for (unsigned i = 0; i < 3; i++)
+	{
+		// One's axis i crossed with each of two's axes
+		const __m128* axis = oneAxes.axis[i];
+		__m128 x = _mm_sub_ps(_mm_mul_ps(axis[1], bRow[2]), _mm_mul_ps(axis[2], bRow[1]));
+		__m128 y = _mm_sub_ps(_mm_mul_ps(axis[2], bRow[0]), _mm_mul_ps(axis[0], bRow[2]));
+		__m128 z = _mm_sub_ps(_mm_mul_ps(axis[0], bRow[1]), _mm_mul_ps(axis[1], bRow[0]));
+
+		penetration = penetrationOnAxesSSE(oneAxes, twoAxes, x, y, z, centre);
+		separated = _mm_or_ps(separated, _mm_cmplt_ps(penetration, _mm_setzero_ps()));
+		_mm_storeu_ps(penetrations + 6 + i * 3, penetration);
+	}
+
+	// Only the first three lanes hold axes. Report the first separating
+	// axis, as the scalar path does
+	if (_mm_movemask_ps(separated) & 7)
+	{
+		for (best = 0; penetrations[best] >= 0; best++);
+		return false;
+	}
+
+	// Keep the first axis with the smallest penetration, as the
+	// scalar path does
+	pen = REAL_MAX;
+	best = 0xffffff;
+	for (unsigned i = 0; i < 15; i++)
+	{
+		if (i == 6) bestSingleAxis = best;
+		if (penetrations[i] < pen)
+		{
+			pen = penetrations[i];
+			best = i;
+		}
+	}
+	return true;
+}
+
+#endif
+
+/**
+* Checks if one of the 15 separating axes, given by its index in the
+* order of the axis search, separates the two boxes.
+*/
+static inline bool separatesOnAxis(
+	const CollisionBox &one,
+	const CollisionBox &two,
+	const Vector3 &toCentre,
+	unsigned index
+)
+{
+	Vector3 axis;
+	if (index < 3) axis = one.getAxis(index);
+	else if (index < 6) axis = two.getAxis(index - 3);
+	else axis = one.getAxis((index - 6) / 3) % two.getAxis((index - 6) % 3);
+
+	// Almost parallel axes are never used to separate the boxes
+	if (axis.squaredMagnitude() < 0.0001) return false;
+	axis.normalize();
+
+	return penetrationOnAxis(one, two, axis, toCentre) < 0;
+}
+
+/**
+* Finds the axis of least penetration between two boxes, with the
+* SSE kernel when it is available and selected. Returns false if the
+* boxes are separated, with best set to the separating axis.
+*/
+static bool findBoxAndBoxAxis(
+	const CollisionBox &one,
+	const CollisionBox &two,
+	const Vector3 &toCentre,
+	real &pen,
+	unsigned &best,
+	unsigned &bestSingleAxis
+)
+{
+#ifdef CRYSTAL_USE_SSE
+	if (CollisionDetector::useSSE)
+	{
+		return findBoxAndBoxAxisSSE(one, two, toCentre, pen, best, bestSingleAxis);
+	}
+#endif
+	return findBoxAndBoxAxisScalar(one, two, toCentre, pen, best, bestSingleAxis);
+}
+
+bool CollisionDetector::boxAndBoxAxis(
+	const CollisionBox &one,
+	const CollisionBox &two,
+	real &penetration,
+	unsigned &axis,
+	unsigned &singleAxis
+)
+{
+	Vector3 toCentre = two.getAxis(3) - one.getAxis(3);
+	return findBoxAndBoxAxis(one, two, toCentre, penetration, axis, singleAxis);
+}
+
+unsigned CollisionDetector::boxAndBox(
+	const CollisionBox &one,
+	const CollisionBox &two,
+	CollisionData *data
+)
+{
+	// Find the vector between the two centres
+	Vector3 toCentre = two.getAxis(3) - one.getAxis(3);
+
+	// Boxes that stay apart are usually separated by the same axis
+	// as in the last frame, so try it first
+	if (data->cachedAxis && *data->cachedAxis != NO_SEPARATING_AXIS)
+	{
+		if (separatesOnAxis(one, two, toCentre, *data->cachedAxis))
+		{
+			data->axisCacheHits++;
+			return 0;
+		}
+		data->axisCacheMisses++;
+	}
+
+	// Find the axis of least penetration, returning if the boxes
+	// are separated
+	real pen;
+	unsigned best, bestSingleAxis;
+	bool found = findBoxAndBoxAxis(one, two, toCentre, pen, best, bestSingleAxis);
+	if (data->cachedAxis) *data->cachedAxis = found ? NO_SEPARATING_AXIS : best;
+	if (!found) return 0;
+
 	// Make sure we've got a result.
 	assert(best != 0xffffff);
 
@@ -575,7 +771,6 @@ unsigned CollisionDetector::boxAndBox(
 	}
 	return 0;
 }
-#undef CHECK_OVERLAP
 
 
 
@@ -741,7 +936,7 @@ unsigned CollisionDetector::boxAndHalfSpace(
 			// Move onto the next contact
 			contact++;
 			contactsUsed++;
-			if (contactsUsed == (unsigned)data->contactsLeft) return contactsUsed;
+			if (contactsUsed == (unsigned)data->contactsLeft) break;
 		}
 	}
 
@@ -10,6 +10,7 @@ void Contact::setBodyData(RigidBody* one, RigidBody *two,
 	Contact::body[1] = two;
 	Contact::friction = friction;
 	Contact::restitution = restitution;
+	accumulatedImpulse.clear();
 }
 
 void Contact::matchAwakeState()
@@ -20,10 +21,12 @@ void Contact::matchAwakeState()
 	bool body0awake = body[0]->getAwake();
 	bool body1awake = body[1]->getAwake();
 
-	// Wake up only the sleeping one
+	// Wake up only the sleeping one. Bodies with infinite mass are
+	// never moved by the resolver, so they are left alone: islands
+	// sharing them may be resolved on different threads.
 	if (body0awake ^ body1awake) {
-		if (body0awake) body[1]->setAwake();
-		else body[0]->setAwake();
+		RigidBody* sleeping = body0awake ? body[1] : body[0];
+		if (sleeping->hasFiniteMass()) sleeping->setAwake();
 	}
 }
 
@@ -214,6 +217,20 @@ void Contact::applyVelocityChange(Vector3 velocityChange[2],
 		impulseContact = calculateFrictionImpulse(inverseInertiaTensor);
 	}
 
+	// Keep track of the total impulse, it is carried over to the next frame
+	accumulatedImpulse += impulseContact;
+
+	applyContactImpulse(impulseContact, velocityChange, rotationChange);
+}
+
+void Contact::applyContactImpulse(const Vector3 &impulseContact,
+	Vector3 velocityChange[2], Vector3 rotationChange[2])
+{
+	Matrix3 inverseInertiaTensor[2];
+	body[0]->getInverseInertiaTensorWorld(&inverseInertiaTensor[0]);
+	if (body[1])
+		body[1]->getInverseInertiaTensorWorld(&inverseInertiaTensor[1]);
+
 	// Convert impulse to world coordinates
 	Vector3 impulse = contactToWorld.transform(impulseContact);
 
@@ -223,9 +240,18 @@ void Contact::applyVelocityChange(Vector3 velocityChange[2],
 	velocityChange[0].clear();
 	velocityChange[0].addScaledVector(impulse, body[0]->getInverseMass());
 
-	// Apply the changes
-	body[0]->addVelocity(velocityChange[0]);
-	body[0]->addRotation(rotationChange[0]);
+	// Apply the changes. Bodies with infinite mass get no change, and
+	// report none, so the resolver's bookkeeping matches the bodies
+	if (body[0]->hasFiniteMass())
+	{
+		body[0]->addVelocity(velocityChange[0]);
+		body[0]->addRotation(rotationChange[0]);
+	}
+	else
+	{
+		velocityChange[0].clear();
+		rotationChange[0].clear();
+	}
 
 	if (body[1])
 	{
@@ -236,8 +262,16 @@ void Contact::applyVelocityChange(Vector3 velocityChange[2],
 		velocityChange[1].addScaledVector(impulse, -body[1]->getInverseMass());
 
 		// And apply them.
-		body[1]->addVelocity(velocityChange[1]);
-		body[1]->addRotation(rotationChange[1]);
+		if (body[1]->hasFiniteMass())
+		{
+			body[1]->addVelocity(velocityChange[1]);
+			body[1]->addRotation(rotationChange[1]);
+		}
+		else
+		{
+			velocityChange[1].clear();
+			rotationChange[1].clear();
+		}
 	}
 }
 
@@ -285,6 +319,44 @@ inline
 Vector3 Contact::calculateFrictionImpulse(Matrix3 * inverseInertiaTensor)
 {
 	Vector3 impulseContact;
+
+	// Find how the closing velocity changes for a unit impulse
+	Matrix3 deltaVelocity = calculateDeltaVelocityMatrix(inverseInertiaTensor);
+
+	// Invert to get the impulse needed per unit velocity
+	Matrix3 impulseMatrix = deltaVelocity.inverse();
+
+	// Find the target velocities to kill
+	Vector3 velKill(desiredDeltaVelocity,
+		-contactVelocity.y,
+		-contactVelocity.z);
+
+	// Find the impulse to kill target velocities
+	impulseContact = impulseMatrix.transform(velKill);
+
+	// Check for exceeding friction
+	real planarImpulse = real_sqrt(
+		impulseContact.y*impulseContact.y +
+		impulseContact.z*impulseContact.z
+	);
+	if (planarImpulse > impulseContact.x * friction)
+	{
+		// We need to use dynamic friction
+		impulseContact.y /= planarImpulse;
+		impulseContact.z /= planarImpulse;
+
+		impulseContact.x = deltaVelocity.data[0] +
+			deltaVelocity.data[1] * friction*impulseContact.y +
+			deltaVelocity.data[2] * friction*impulseContact.z;
+		impulseContact.x = desiredDeltaVelocity / impulseContact.x;
+		impulseContact.y *= friction * impulseContact.x;
+		impulseContact.z *= friction * impulseContact.x;
+	}
+	return impulseContact;
+}
+
+Matrix3 Contact::calculateDeltaVelocityMatrix(Matrix3 * inverseInertiaTensor)
+{
 	real inverseMass = body[0]->getInverseMass();
 
 	// The equivalent of a cross product in matrices is multiplication
@@ -329,36 +401,7 @@ Vector3 Contact::calculateFrictionImpulse(Matrix3 * inverseInertiaTensor)
 	deltaVelocity.data[4] += inverseMass;
 	deltaVelocity.data[8] += inverseMass;
 
-	// Invert to get the impulse needed per unit velocity
-	Matrix3 impulseMatrix = deltaVelocity.inverse();
-
-	// Find the target velocities to kill
-	Vector3 velKill(desiredDeltaVelocity,
-		-contactVelocity.y,
-		-contactVelocity.z);
-
-	// Find the impulse to kill target velocities
-	impulseContact = impulseMatrix.transform(velKill);
-
-	// Check for exceeding friction
-	real planarImpulse = real_sqrt(
-		impulseContact.y*impulseContact.y +
-		impulseContact.z*impulseContact.z
-	);
-	if (planarImpulse > impulseContact.x * friction)
-	{
-		// We need to use dynamic friction
-		impulseContact.y /= planarImpulse;
-		impulseContact.z /= planarImpulse;
-
-		impulseContact.x = deltaVelocity.data[0] +
-			deltaVelocity.data[1] * friction*impulseContact.y +
-			deltaVelocity.data[2] * friction*impulseContact.z;
-		impulseContact.x = desiredDeltaVelocity / impulseContact.x;
-		impulseContact.y *= friction * impulseContact.x;
-		impulseContact.z *= friction * impulseContact.x;
-	}
-	return impulseContact;
+	return deltaVelocity;
 }
 
 void Contact::applyPositionChange(Vector3 linearChange[2],
@@ -466,6 +509,15 @@ void Contact::applyPositionChange(Vector3 linearChange[2],
 		// along the contact normal.
 		linearChange[i] = contactNormal * linearMove[i];
 
+		// Bodies with infinite mass don't move, so they are not written
+		// and report no change
+		if (!body[i]->hasFiniteMass())
+		{
+			linearChange[i].clear();
+			angularChange[i].clear();
+			continue;
+		}
+
 		// Now we can start to apply the values we've calculated.
 		// Apply the linear movement
 		Vector3 pos;
@@ -500,6 +552,14 @@ ContactResolver::ContactResolver(unsigned iterations,
 {
 	setIterations(iterations, iterations);
 	setEpsilon(velocityEpsilon, positionEpsilon);
+	setWarmStartFactor(0);
+	setMode(RESOLVER_WORST_FIRST);
+	setPositionMode(POSITION_PROJECTION);
+	setWorkers(NULL);
+	setTimeBudget(0);
+	velocityIterationsUsed = positionIterationsUsed = 0;
+	velocityResidual = positionResidual = 0;
+	budgetExceeded = false;
 }
 
 ContactResolver::ContactResolver(unsigned velocityIterations,
@@ -509,6 +569,14 @@ ContactResolver::ContactResolver(unsigned velocityIterations,
 {
 	setIterations(velocityIterations);
 	setEpsilon(velocityEpsilon, positionEpsilon);
+	setWarmStartFactor(0);
+	setMode(RESOLVER_WORST_FIRST);
+	setPositionMode(POSITION_PROJECTION);
+	setWorkers(NULL);
+	setTimeBudget(0);
+	velocityIterationsUsed = positionIterationsUsed = 0;
+	velocityResidual = positionResidual = 0;
+	budgetExceeded = false;
 }
 
 void ContactResolver::setIterations(unsigned iterations)
@@ -534,20 +602,166 @@ void ContactResolver::resolveContacts(Contact *contacts,
 	unsigned numContacts,
 	real duration)
 {
+	velocityIterationsUsed = positionIterationsUsed = 0;
+	velocityResidual = positionResidual = 0;
+	budgetExceeded = false;
+
 	// Make sure we have something to do.
 	if (numContacts == 0) return;
 	if (!isValid()) return;
 
+	// Give the position stage up to half of the time budget, and the
+	// velocity stage whatever is left
+	SolverClock::time_point start = SolverClock::now();
+	if (timeBudget > 0)
+	{
+		positionDeadline = start + std::chrono::microseconds(timeBudget / 2);
+		velocityDeadline = start + std::chrono::microseconds(timeBudget);
+	}
+	else
+	{
+		positionDeadline = velocityDeadline = SolverClock::time_point::max();
+	}
+
 	// Prepare the contacts for processing
 	prepareContacts(contacts, numContacts, duration);
 
+	// Both sweeping stages resolve every contact, so wake up both
+	// sides now. The contacts are packed before warm starting, so
+	// bounces use the velocities the contacts closed with.
+	if (mode == RESOLVER_SEQUENTIAL_IMPULSE || positionMode == POSITION_SPLIT_IMPULSE)
+	{
+		for (unsigned i = 0; i < numContacts; i++)
+		{
+			contacts[i].matchAwakeState();
+		}
+		batchSolver.build(contacts, numContacts, contactBodies, bodyContactStart.size() - 1);
+	}
+
 	// Resolve the interpenetration problems with the contacts.
-	adjustPositions(contacts, numContacts, duration);
+	if (positionMode == POSITION_SPLIT_IMPULSE) pushPositions(duration);
+	else adjustPositions(contacts, numContacts, duration);
+
+	if (mode == RESOLVER_SEQUENTIAL_IMPULSE)
+	{
+		sweepVelocities(contacts, numContacts, duration);
+		return;
+	}
+
+	// Start from the impulses of the last frame, so resting contacts
+	// need far fewer iterations.
+	warmStart(contacts, numContacts, duration);
 
 	// Resolve the velocity problems with the contacts.
 	adjustVelocities(contacts, numContacts, duration);
 }
 
+void ContactResolver::warmStart(Contact *c,
+	unsigned numContacts,
+	real duration)
+{
+	Vector3 velocityChange[2], rotationChange[2];
+
+	if (warmStartFactor <= 0)
+	{
+		for (unsigned i = 0; i < numContacts; i++) c[i].accumulatedImpulse.clear();
+		return;
+	}
+
+	bool applied = false;
+	for (unsigned i = 0; i < numContacts; i++)
+	{
+		Vector3 impulse = c[i].accumulatedImpulse * warmStartFactor;
+		c[i].accumulatedImpulse.clear();
+
+		// Only push the bodies apart, never pull them together
+		if (impulse.x <= 0) continue;
+
+		// Keep the friction impulse inside the friction cone
+		real planarImpulse = real_sqrt(impulse.y*impulse.y + impulse.z*impulse.z);
+		if (planarImpulse > impulse.x * c[i].friction)
+		{
+			real scale = planarImpulse > 0 ? impulse.x * c[i].friction / planarImpulse : 0;
+			impulse.y *= scale;
+			impulse.z *= scale;
+		}
+
+		c[i].matchAwakeState();
+		c[i].applyContactImpulse(impulse, velocityChange, rotationChange);
+		c[i].accumulatedImpulse = impulse;
+		applied = true;
+	}
+	if (!applied) return;
+
+	// The velocities of the bodies changed, so recalculate the closing
+	// velocities of all the contacts.
+	for (unsigned i = 0; i < numContacts; i++)
+	{
+		c[i].contactVelocity = c[i].calculateLocalVelocity(0, duration);
+		if (c[i].body[1]) {
+			c[i].contactVelocity -= c[i].calculateLocalVelocity(1, duration);
+		}
+		c[i].calculateDesiredDeltaVelocity(duration);
+	}
+}
+
+void ContactHeap::siftUp(unsigned index)
+{
+	unsigned contact = heap[index];
+	while (index > 0)
+	{
+		unsigned parent = (index - 1) / 2;
+		if (!isAbove(contact, heap[parent])) break;
+		heap[index] = heap[parent];
+		place[heap[index]] = index;
+		index = parent;
+	}
+	heap[index] = contact;
+	place[contact] = index;
+}
+
+void ContactHeap::siftDown(unsigned index)
+{
+	unsigned contact = heap[index];
+	unsigned count = heap.size();
+	for (;;)
+	{
+		unsigned child = index * 2 + 1;
+		if (child >= count) break;
+		if (child + 1 < count && isAbove(heap[child + 1], heap[child])) child++;
+		if (!isAbove(heap[child], contact)) break;
+		heap[index] = heap[child];
+		place[heap[index]] = index;
+		index = child;
+	}
+	heap[index] = contact;
+	place[contact] = index;
+}
+
+void ContactHeap::build()
+{
+	unsigned count = severity.size();
+	heap.resize(count);
+	place.resize(count);
+	for (unsigned i = 0; i < count; i++)
+	{
+		heap[i] = i;
+		place[i] = i;
+	}
+	for (unsigned i = count / 2; i > 0; i--)
+	{
+		siftDown(i - 1);
+	}
+}
+
+void ContactHeap::update(unsigned contact, real value)
+{
+	real old = severity[contact];
+	severity[contact] = value;
+	if (value > old) siftUp(place[contact]);
+	else siftDown(place[contact]);
+}
+
 void ContactResolver::prepareContacts(Contact* contacts,
 	unsigned numContacts,
 	real duration)
@@ -559,6 +773,64 @@ void ContactResolver::prepareContacts(Contact* contacts,
 		// Calculate the internal contact data (inertia, basis, etc).
 		contact->calculateInternals(duration);
 	}
+
+	// Count the contacts of each body that can move. Bodies are
+	// numbered in the order they are first found.
+	contactBodies.resize(numContacts * 2);
+	bodyContactStart.clear();
+	for (unsigned i = 0; i < numContacts * 2; i++)
+	{
+		RigidBody* body = contacts[i / 2].body[i % 2];
+		if (!body || !body->hasFiniteMass())
+		{
+			contactBodies[i] = NO_CONTACT_BODY;
+			continue;
+		}
+
+		unsigned index = bodyIndex.get(body);
+		if (index == NO_BODY_INDEX)
+		{
+			index = bodyContactStart.size();
+			bodyIndex.set(body, index);
+			bodyContactStart.push_back(0);
+		}
+		contactBodies[i] = index;
+		bodyContactStart[index]++;
+	}
+
+	// Turn the counts into the start of each body's list
+	unsigned bodyCount = bodyContactStart.size();
+	unsigned start = 0;
+	for (unsigned i = 0; i < bodyCount; i++)
+	{
+		unsigned count = bodyContactStart[i];
+		bodyContactStart[i] = start;
+		start += count;
+	}
+	bodyContactStart.push_back(start);
+
+	// Fill the lists, using the starts as cursors, then move the
+	// starts back into place
+	bodyContacts.resize(start);
+	for (unsigned i = 0; i < numContacts * 2; i++)
+	{
+		if (contactBodies[i] != NO_CONTACT_BODY)
+		{
+			bodyContacts[bodyContactStart[contactBodies[i]]++] = i;
+		}
+	}
+	for (unsigned i = bodyCount; i > 0; i--)
+	{
+		bodyContactStart[i] = bodyContactStart[i - 1];
+	}
+	bodyContactStart[0] = 0;
+
+	// Clear the body indices for the next call
+	for (unsigned i = 0; i < numContacts * 2; i++)
+	{
+		RigidBody* body = contacts[i / 2].body[i % 2];
+		if (body && body->hasFiniteMass()) bodyIndex.clear(body);
+	}
 }
 
 void ContactResolver::adjustVelocities(Contact *c,
@@ -568,22 +840,29 @@ void ContactResolver::adjustVelocities(Contact *c,
 	Vector3 velocityChange[2], rotationChange[2];
 	Vector3 deltaVel;
 
+	// Keep the contacts ordered by their desired velocity change
+	severityHeap.reset(numContacts);
+	for (unsigned i = 0; i < numContacts; i++)
+	{
+		severityHeap.setSeverity(i, c[i].desiredDeltaVelocity);
+	}
+	severityHeap.build();
+
 	// iteratively handle impacts in order of severity.
 	velocityIterationsUsed = 0;
 	while (velocityIterationsUsed < velocityIterations)
 	{
 		// Find contact with maximum magnitude of probable velocity change.
-		real max = velocityEpsilon;
-		unsigned index = numContacts;
-		for (unsigned i = 0; i < numContacts; i++)
+		unsigned index = severityHeap.top();
+		if (!(severityHeap.getSeverity(index) > velocityEpsilon)) break;
+
+		// Check the clock now and then, leaving the rest for the next frame
+		if (timeBudget > 0 && velocityIterationsUsed % RESOLVER_CLOCK_INTERVAL == RESOLVER_CLOCK_INTERVAL - 1 &&
+			SolverClock::now() > velocityDeadline)
 		{
-			if (c[i].desiredDeltaVelocity > max)
-			{
-				max = c[i].desiredDeltaVelocity;
-				index = i;
-			}
+			budgetExceeded = true;
+			break;
 		}
-		if (index == numContacts) break;
 
 		// Match the awake state at the contact
 		c[index].matchAwakeState();
@@ -593,34 +872,55 @@ void ContactResolver::adjustVelocities(Contact *c,
 
 		// With the change in velocity of the two bodies, the update of
 		// contact velocities means that some of the relative closing
-		// velocities need recomputing.
-		for (unsigned i = 0; i < numContacts; i++)
+		// velocities need recomputing. Only the contacts of the two
+		// bodies are affected.
+		for (unsigned d = 0; d < 2; d++)
 		{
-			// Check each body in the contact
-			for (unsigned b = 0; b < 2; b++) if (c[i].body[b])
+			unsigned body = contactBodies[index * 2 + d];
+			if (body == NO_CONTACT_BODY) continue;
+
+			for (unsigned j = bodyContactStart[body]; j < bodyContactStart[body + 1]; j++)
 			{
-				// Check for a match with each body in the newly
-				// resolved contact
-				for (unsigned d = 0; d < 2; d++)
-				{
-					if (c[i].body[b] == c[index].body[d])
-					{
-						deltaVel = velocityChange[d] +
-							rotationChange[d].vectorProduct(
-								c[i].relativeContactPosition[b]);
-
-						// The sign of the change is negative if we're dealing
-						// with the second body in a contact.
-						c[i].contactVelocity +=
-							c[i].contactToWorld.transformTranspose(deltaVel)
-							* (b ? -1 : 1);
-						c[i].calculateDesiredDeltaVelocity(duration);
-					}
-				}
+				unsigned i = bodyContacts[j] / 2;
+				unsigned b = bodyContacts[j] % 2;
+
+				deltaVel = velocityChange[d] +
+					rotationChange[d].vectorProduct(
+						c[i].relativeContactPosition[b]);
+
+				// The sign of the change is negative if we're dealing
+				// with the second body in a contact.
+				c[i].contactVelocity +=
+					c[i].contactToWorld.transformTranspose(deltaVel)
+					* (b ? -1 : 1);
+				c[i].calculateDesiredDeltaVelocity(duration);
+				severityHeap.update(i, c[i].desiredDeltaVelocity);
 			}
 		}
 		velocityIterationsUsed++;
 	}
+
+	real left = severityHeap.getSeverity(severityHeap.top());
+	velocityResidual = left > 0 ? left : 0;
+}
+
+void ContactResolver::sweepVelocities(Contact *c,
+	unsigned numContacts,
+	real duration)
+{
+	warmStart(c, numContacts, duration);
+
+	velocityIterationsUsed = batchSolver.solve(c, sweeps, velocityEpsilon, velocityDeadline, workers);
+	velocityResidual = batchSolver.getResidual();
+	if (batchSolver.hasTimedOut()) budgetExceeded = true;
+}
+
+void ContactResolver::pushPositions(real duration)
+{
+	positionIterationsUsed = batchSolver.solvePositions(duration, splitImpulseFactor,
+		positionEpsilon, velocityEpsilon, sweeps, positionDeadline, workers);
+	positionResidual = batchSolver.getResidual();
+	if (batchSolver.hasTimedOut()) budgetExceeded = true;
 }
 
 void ContactResolver::adjustPositions(Contact *c,
@@ -632,22 +932,30 @@ void ContactResolver::adjustPositions(Contact *c,
 	real max;
 	Vector3 deltaPosition;
 
+	// Keep the contacts ordered by their penetration
+	severityHeap.reset(numContacts);
+	for (i = 0; i < numContacts; i++)
+	{
+		severityHeap.setSeverity(i, c[i].penetration);
+	}
+	severityHeap.build();
+
 	// iteratively resolve interpenetrations in order of severity.
 	positionIterationsUsed = 0;
 	while (positionIterationsUsed < positionIterations)
 	{
 		// Find biggest penetration
-		max = positionEpsilon;
-		index = numContacts;
-		for (i = 0; i < numContacts; i++)
+		index = severityHeap.top();
+		max = severityHeap.getSeverity(index);
+		if (!(max > positionEpsilon)) break;
+
+		// Check the clock now and then, leaving the rest for the next frame
+		if (timeBudget > 0 && positionIterationsUsed % RESOLVER_CLOCK_INTERVAL == RESOLVER_CLOCK_INTERVAL - 1 &&
+			SolverClock::now() > positionDeadline)
 		{
-			if (c[i].penetration > max)
-			{
-				max = c[i].penetration;
-				index = i;
-			}
+			budgetExceeded = true;
+			break;
 		}
-		if (index == numContacts) break;
 
 		// Match the awake state at the contact
 		c[index].matchAwakeState();
@@ -659,33 +967,195 @@ void ContactResolver::adjustPositions(Contact *c,
 			max);
 
 		// Again this action may have changed the penetration of other
-		// bodies, so we update contacts.
-		for (i = 0; i < numContacts; i++)
+		// bodies, so we update the contacts of the two bodies.
+		for (unsigned d = 0; d < 2; d++)
 		{
-			// Check each body in the contact
-			for (unsigned b = 0; b < 2; b++) if (c[i].body[b])
+			unsigned body = contactBodies[index * 2 + d];
+			if (body == NO_CONTACT_BODY) continue;
+
+			for (unsigned j = bodyContactStart[body]; j < bodyContactStart[body + 1]; j++)
 			{
-				// Check for a match with each body in the newly
-				// resolved contact
-				for (unsigned d = 0; d < 2; d++)
-				{
-					if (c[i].body[b] == c[index].body[d])
-					{
-						deltaPosition = linearChange[d] +
-							angularChange[d].vectorProduct(
-								c[i].relativeContactPosition[b]);
-
-						// The sign of the change is positive if we're
-						// dealing with the second body in a contact
-						// and negative otherwise (because we're
-						// subtracting the resolution)..
-						c[i].penetration +=
-							deltaPosition.scalarProduct(c[i].contactNormal)
-							* (b ? 1 : -1);
-					}
-				}
+				i = bodyContacts[j] / 2;
+				unsigned b = bodyContacts[j] % 2;
+
+				deltaPosition = linearChange[d] +
+					angularChange[d].vectorProduct(
+						c[i].relativeContactPosition[b]);
+
+				// The sign of the change is positive if we're
+				// dealing with the second body in a contact
+				// and negative otherwise (because we're
+				// subtracting the resolution)..
+				c[i].penetration +=
+					deltaPosition.scalarProduct(c[i].contactNormal)
+					* (b ? 1 : -1);
+				severityHeap.update(i, c[i].penetration);
 			}
 		}
 		positionIterationsUsed++;
 	}
-}
\ No newline at end of file
+
+	max = severityHeap.getSeverity(severityHeap.top());
+	positionResidual = max > 0 ? max : 0;
+}
+
+// Contact manifold implementation
+
+void ContactManifold::refresh(real breakingThreshold)
+{
+	for (unsigned i = 0; i < pointCount;)
+	{
+		ManifoldPoint& point = points[i];
+
+		// Find where the two anchors of the point are now
+		Vector3 worldPoint[2];
+		worldPoint[0] = body[0]->getPointInWorldSpace(point.localPoint[0]);
+		worldPoint[1] = body[1] ? body[1]->getPointInWorldSpace(point.localPoint[1]) : point.localPoint[1];
+
+		// The anchors started at the same place, so their separation
+		// gives the change of penetration and the sliding distance
+		Vector3 drift = worldPoint[1] - worldPoint[0];
+		real normalDrift = drift * point.normal;
+		Vector3 tangentDrift = drift - point.normal * normalDrift;
+		real penetration = point.penetration + normalDrift;
+
+		if (penetration < -breakingThreshold ||
+			tangentDrift.squaredMagnitude() > breakingThreshold * breakingThreshold)
+		{
+			// Drop the point, moving the last one into its place
+			points[i] = points[--pointCount];
+			continue;
+		}
+
+		point.position = (worldPoint[0] + worldPoint[1]) * ((real)0.5);
+		point.currentPenetration = penetration;
+		i++;
+	}
+}
+
+void ContactManifold::addContact(const Contact& contact, real breakingThreshold)
+{
+	const static real normalTolerance = (real)0.95f;
+
+	// Keep the body order of the manifold, flipping the contact if needed
+	Vector3 normal = contact.contactNormal;
+	if (pointCount > 0 && contact.body[0] == body[1] && contact.body[1] == body[0])
+	{
+		normal *= -1;
+	}
+	else if (pointCount == 0 || contact.body[0] != body[0] || contact.body[1] != body[1])
+	{
+		pointCount = 0;
+		body[0] = contact.body[0];
+		body[1] = contact.body[1];
+	}
+
+	ManifoldPoint point;
+	point.localPoint[0] = body[0]->getPointInLocalSpace(contact.contactPoint);
+	point.localPoint[1] = body[1] ? body[1]->getPointInLocalSpace(contact.contactPoint) : contact.contactPoint;
+	point.normal = normal;
+	point.penetration = contact.penetration;
+	point.position = contact.contactPoint;
+	point.currentPenetration = contact.penetration;
+	point.accumulatedImpulse.clear();
+
+	// Points with a very different normal come from another feature, drop them
+	for (unsigned i = 0; i < pointCount;)
+	{
+		if (points[i].normal * normal < normalTolerance) points[i] = points[--pointCount];
+		else i++;
+	}
+
+	// A new contact close to a cached point replaces it, keeping its impulse
+	real closest = breakingThreshold * breakingThreshold;
+	unsigned index = pointCount;
+	for (unsigned i = 0; i < pointCount; i++)
+	{
+		real distance = (points[i].position - point.position).squaredMagnitude();
+		if (distance <= closest)
+		{
+			closest = distance;
+			index = i;
+		}
+	}
+
+	if (index < pointCount)
+	{
+		point.accumulatedImpulse = points[index].accumulatedImpulse;
+	}
+	else if (pointCount < MAX_MANIFOLD_POINTS)
+	{
+		index = pointCount++;
+	}
+	else
+	{
+		index = getReplacedPoint(point);
+	}
+	points[index] = point;
+}
+
+/**
+* Returns the squared area of the quad of the given points, estimated
+* from the largest cross product of its diagonals.
+*/
+static inline real quadArea(const Vector3& a, const Vector3& b, const Vector3& c, const Vector3& d)
+{
+	real area = ((a - b) % (c - d)).squaredMagnitude();
+	real area2 = ((a - c) % (b - d)).squaredMagnitude();
+	real area3 = ((a - d) % (b - c)).squaredMagnitude();
+	if (area2 > area) area = area2;
+	if (area3 > area) area = area3;
+	return area;
+}
+
+unsigned ContactManifold::getReplacedPoint(const ManifoldPoint& point) const
+{
+	// Always keep the deepest point
+	unsigned deepest = MAX_MANIFOLD_POINTS;
+	real maxPenetration = point.currentPenetration;
+	for (unsigned i = 0; i < MAX_MANIFOLD_POINTS; i++)
+	{
+		if (points[i].currentPenetration > maxPenetration)
+		{
+			maxPenetration = points[i].currentPenetration;
+			deepest = i;
+		}
+	}
+
+	// Replace the point whose removal leaves the largest contact area
+	real maxArea = -1;
+	unsigned result = 0;
+	for (unsigned i = 0; i < MAX_MANIFOLD_POINTS; i++)
+	{
+		if (i == deepest) continue;
+		Vector3 corner[MAX_MANIFOLD_POINTS];
+		for (unsigned j = 0; j < MAX_MANIFOLD_POINTS; j++)
+		{
+			corner[j] = j == i ? point.position : points[j].position;
+		}
+		real area = quadArea(corner[0], corner[1], corner[2], corner[3]);
+		if (area > maxArea)
+		{
+			maxArea = area;
+			result = i;
+		}
+	}
+	return result;
+}
+
+unsigned ContactManifold::writeContacts(Contact* contacts, unsigned limit, real friction, real restitution,
+	ManifoldPoint** writtenPoints)
+{
+	unsigned count = pointCount < limit ? pointCount : limit;
+	for (unsigned i = 0; i < count; i++)
+	{
+		Contact& contact = contacts[i];
+		contact.contactPoint = points[i].position;
+		contact.contactNormal = points[i].normal;
+		contact.penetration = points[i].currentPenetration;
+		contact.setBodyData(body[0], body[1], friction, restitution);
+		contact.accumulatedImpulse = points[i].accumulatedImpulse;
+		writtenPoints[i] = &points[i];
+	}
+	return count;
+}
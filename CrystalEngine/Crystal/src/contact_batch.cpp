@@ -0,0 +1,619 @@
+#include <crystal\contact.h>
+#ifdef CRYSTAL_USE_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace crystal;
+
+bool ContactBatchSolver::useSSE = true;
+
+void ContactBatchSolver::setLane(ContactBatch& batch, unsigned lane, const Contact& contact)
+{
+	Matrix3 inverseInertiaTensor[2];
+	bool moves[2];
+	for (unsigned b = 0; b < 2; b++)
+	{
+		moves[b] = batch.body[b][lane] < bodies.size();
+		if (moves[b]) contact.body[b]->getInverseInertiaTensorWorld(&inverseInertiaTensor[b]);
+		batch.inverseMass[b][lane] = moves[b] ? contact.body[b]->getInverseMass() : 0;
+	}
+
+	for (unsigned a = 0; a < 3; a++)
+	{
+		// The columns of the contact basis are the constraint axes
+		const real* basis = contact.contactToWorld.data;
+		Vector3 axis(basis[a], basis[a + 3], basis[a + 6]);
+
+		// Work out the change in velocity along the axis for a unit
+		// impulse along it, the same as the diagonal of the matrix
+		// used by the worst first mode.
+		real deltaVelocity = batch.inverseMass[0][lane] + batch.inverseMass[1][lane];
+		for (unsigned b = 0; b < 2; b++)
+		{
+			Vector3 torqueAxis, rotationPerImpulse;
+			if (moves[b])
+			{
+				torqueAxis = contact.relativeContactPosition[b] % axis;
+				rotationPerImpulse = inverseInertiaTensor[b].transform(torqueAxis);
+				deltaVelocity += torqueAxis * rotationPerImpulse;
+			}
+			for (unsigned c = 0; c < 3; c++)
+			{
+				batch.torqueAxis[b][a][c][lane] = torqueAxis[c];
+				batch.rotationPerImpulse[b][a][c][lane] = rotationPerImpulse[c];
+			}
+		}
+
+		for (unsigned c = 0; c < 3; c++) batch.axis[a][c][lane] = axis[c];
+		batch.impulsePerVelocity[a][lane] = deltaVelocity > 0 ? (real)1.0 / deltaVelocity : 0;
+	}
+
+	// The desired change already holds the bounce, with the
+	// restitution dropped for slow contacts.
+	batch.targetVelocity[lane] = contact.contactVelocity.x + contact.desiredDeltaVelocity;
+	batch.friction[lane] = contact.friction;
+	batch.penetration[lane] = contact.penetration;
+}
+
+unsigned ContactBatchSolver::takeColor(unsigned one, unsigned two, unsigned bodyCount)
+{
+	unsigned color = colorWords * 64;
+	for (unsigned word = 0; word < colorWords; word++)
+	{
+		unsigned long long used = 0;
+		if (one != NO_CONTACT_BODY) used |= bodyColors[one * colorWords + word];
+		if (two != NO_CONTACT_BODY) used |= bodyColors[two * colorWords + word];
+		if (~used == 0) continue;
+
+		unsigned bit = 0;
+		while (used & 1)
+		{
+			used >>= 1;
+			bit++;
+		}
+		color = word * 64 + bit;
+		break;
+	}
+
+	// Every color is taken, so make room for more
+	if (color == colorWords * 64)
+	{
+		std::vector<unsigned long long> grown(bodyCount * (colorWords + 1), 0);
+		for (unsigned i = 0; i < bodyCount; i++)
+		{
+			for (unsigned word = 0; word < colorWords; word++)
+			{
+				grown[i * (colorWords + 1) + word] = bodyColors[i * colorWords + word];
+			}
+		}
+		bodyColors.swap(grown);
+		colorWords++;
+	}
+
+	unsigned long long bit = 1ull << (color % 64);
+	if (one != NO_CONTACT_BODY) bodyColors[one * colorWords + color / 64] |= bit;
+	if (two != NO_CONTACT_BODY) bodyColors[two * colorWords + color / 64] |= bit;
+	return color;
+}
+
+void ContactBatchSolver::build(Contact *contacts, unsigned numContacts,
+	const std::vector<unsigned>& contactBodies, unsigned bodyCount)
+{
+	// Find the bodies that can move. The slot after them is shared by
+	// all the others.
+	bodies.resize(bodyCount);
+	for (unsigned i = 0; i < numContacts * 2; i++)
+	{
+		if (contactBodies[i] != NO_CONTACT_BODY) bodies[contactBodies[i]] = contacts[i / 2].body[i % 2];
+	}
+	velocities.resize(bodyCount + 1);
+	pushVelocities.resize(bodyCount + 1);
+
+	// Color the contacts, counting the contacts of each color
+	colorWords = 1;
+	bodyColors.assign(bodyCount, 0);
+	contactColor.resize(numContacts);
+	colorStart.clear();
+	for (unsigned i = 0; i < numContacts; i++)
+	{
+		unsigned color = takeColor(contactBodies[i * 2], contactBodies[i * 2 + 1], bodyCount);
+		if (color >= colorStart.size()) colorStart.resize(color + 1, 0);
+		colorStart[color]++;
+		contactColor[i] = color;
+	}
+
+	// Turn the counts into the first batch of each color. Each color
+	// starts a new batch, so only its last batch can have empty lanes.
+	unsigned colorCount = colorStart.size();
+	colorCursor.resize(colorCount);
+	unsigned start = 0;
+	for (unsigned color = 0; color < colorCount; color++)
+	{
+		unsigned count = colorStart[color];
+		colorStart[color] = start;
+		colorCursor[color] = start * CONTACT_BATCH_LANES;
+		start += (count + CONTACT_BATCH_LANES - 1) / CONTACT_BATCH_LANES;
+	}
+	colorStart.push_back(start);
+
+	// Start every batch with its lanes empty
+	batches.resize(start);
+	for (auto& batch : batches)
+	{
+		for (unsigned lane = 0; lane < CONTACT_BATCH_LANES; lane++)
+		{
+			batch.contact[lane] = NO_BATCH_CONTACT;
+			batch.body[0][lane] = batch.body[1][lane] = bodyCount;
+			for (unsigned a = 0; a < 3; a++) batch.impulsePerVelocity[a][lane] = 0;
+			batch.inverseMass[0][lane] = batch.inverseMass[1][lane] = 0;
+			batch.penetration[lane] = 0;
+		}
+	}
+
+	// Fill the lanes color by color
+	for (unsigned i = 0; i < numContacts; i++)
+	{
+		unsigned slot = colorCursor[contactColor[i]]++;
+		ContactBatch& batch = batches[slot / CONTACT_BATCH_LANES];
+		unsigned lane = slot % CONTACT_BATCH_LANES;
+
+		batch.contact[lane] = i;
+		for (unsigned b = 0; b < 2; b++)
+		{
+			unsigned body = contactBodies[i * 2 + b];
+			if (body != NO_CONTACT_BODY) batch.body[b][lane] = body;
+		}
+		setLane(batch, lane, contacts[i]);
+	}
+}
+
+unsigned ContactBatchSolver::solve(Contact *contacts, unsigned sweeps, real tolerance,
+	SolverClock::time_point deadline, WorkerPool* workers)
+{
+	// Take the velocities left by warm starting
+	unsigned bodyCount = bodies.size();
+	for (unsigned i = 0; i < bodyCount; i++)
+	{
+		velocities[i].velocity = bodies[i]->getVelocity();
+		velocities[i].rotation = bodies[i]->getRotation();
+	}
+	velocities[bodyCount].velocity.clear();
+	velocities[bodyCount].rotation.clear();
+
+	// Start from the impulses already applied
+	for (auto& batch : batches)
+	{
+		for (unsigned lane = 0; lane < CONTACT_BATCH_LANES; lane++)
+		{
+			unsigned contact = batch.contact[lane];
+			for (unsigned a = 0; a < 3; a++)
+			{
+				batch.impulse[a][lane] = contact != NO_BATCH_CONTACT ? contacts[contact].accumulatedImpulse[a] : 0;
+			}
+		}
+	}
+
+	unsigned sweep = 0;
+	timedOut = false;
+	while (sweep < sweeps)
+	{
+		residual = sweepColors(false, workers);
+		sweep++;
+
+		// Stop once the contacts have settled, or the time is up
+		if (!(residual > tolerance)) break;
+		if (sweep < sweeps && SolverClock::now() > deadline)
+		{
+			timedOut = true;
+			break;
+		}
+	}
+
+	// Write the results back
+	for (unsigned i = 0; i < bodyCount; i++)
+	{
+		bodies[i]->setVelocity(velocities[i].velocity);
+		bodies[i]->setRotation(velocities[i].rotation);
+	}
+	for (auto& batch : batches)
+	{
+		for (unsigned lane = 0; lane < CONTACT_BATCH_LANES; lane++)
+		{
+			unsigned contact = batch.contact[lane];
+			if (contact == NO_BATCH_CONTACT) continue;
+
+			contacts[contact].accumulatedImpulse = Vector3(
+				batch.impulse[0][lane], batch.impulse[1][lane], batch.impulse[2][lane]);
+		}
+	}
+	return sweep;
+}
+
+unsigned ContactBatchSolver::solvePositions(real duration, real factor, real slop, real tolerance,
+	unsigned sweeps, SolverClock::time_point deadline, WorkerPool* workers)
+{
+	// Every body starts the stage with no pseudo velocity
+	unsigned bodyCount = bodies.size();
+	for (auto& body : pushVelocities)
+	{
+		body.velocity.clear();
+		body.rotation.clear();
+	}
+
+	for (auto& batch : batches)
+	{
+		for (unsigned lane = 0; lane < CONTACT_BATCH_LANES; lane++)
+		{
+			real depth = batch.penetration[lane] - slop;
+			batch.pushVelocity[lane] = depth > 0 ? depth * factor / duration : 0;
+			batch.pushImpulse[lane] = 0;
+		}
+	}
+
+	unsigned sweep = 0;
+	timedOut = false;
+	while (sweep < sweeps)
+	{
+		residual = sweepColors(true, workers);
+		sweep++;
+
+		// Stop once the pushes have settled, or the time is up
+		if (!(residual > tolerance)) break;
+		if (sweep < sweeps && SolverClock::now() > deadline)
+		{
+			timedOut = true;
+			break;
+		}
+	}
+	residual *= duration;
+
+	// Move the bodies, then bring their derived data up to date
+	for (unsigned i = 0; i < bodyCount; i++)
+	{
+		const BodyVelocity& push = pushVelocities[i];
+		if (push.velocity.x == 0 && push.velocity.y == 0 && push.velocity.z == 0 &&
+			push.rotation.x == 0 && push.rotation.y == 0 && push.rotation.z == 0) continue;
+
+		RigidBody* body = bodies[i];
+		Vector3 position = body->getPosition();
+		position.addScaledVector(push.velocity, duration);
+		body->setPosition(position);
+
+		Quaternion orientation = body->getOrientation();
+		orientation.addScaledVector(push.rotation, duration);
+		body->setOrientation(orientation);
+
+		body->calculateDerivedData();
+	}
+	return sweep;
+}
+
+real ContactBatchSolver::sweepColors(bool push, WorkerPool* workers)
+{
+	// Each task solves a run of batches of the current color, keeping
+	// the largest error its worker found
+	unsigned colorFirst = 0, colorLast = 0;
+	WorkerPool::TaskFunction solveTask = [&](unsigned task, unsigned worker)
+	{
+		unsigned first = colorFirst + task * CONTACT_BATCHES_PER_TASK;
+		unsigned last = first + CONTACT_BATCHES_PER_TASK;
+		real error = solveBatches(first, last < colorLast ? last : colorLast, push);
+		if (error > workerResidual[worker]) workerResidual[worker] = error;
+	};
+	if (workers) workerResidual.assign(workers->getWorkerCount(), 0);
+
+	real residual = 0;
+	unsigned colorCount = getColorCount();
+	for (unsigned color = 0; color < colorCount; color++)
+	{
+		colorFirst = colorStart[color];
+		colorLast = colorStart[color + 1];
+
+		// Share the color out if there is a task for each worker
+		unsigned taskCount = (colorLast - colorFirst + CONTACT_BATCHES_PER_TASK - 1) / CONTACT_BATCHES_PER_TASK;
+		if (!workers || taskCount < workers->getWorkerCount())
+		{
+			real error = solveBatches(colorFirst, colorLast, push);
+			if (error > residual) residual = error;
+			continue;
+		}
+
+		colorTasks.resize(taskCount);
+		for (unsigned i = 0; i < taskCount; i++) colorTasks[i] = i;
+		workers->run(colorTasks, solveTask);
+	}
+	if (workers)
+	{
+		for (real error : workerResidual)
+		{
+			if (error > residual) residual = error;
+		}
+	}
+	return residual;
+}
+
+real ContactBatchSolver::solveBatches(unsigned first, unsigned last, bool push)
+{
+	real residual = 0;
+	for (unsigned i = first; i < last; i++)
+	{
+		real error;
+		if (push) error = solvePushBatch(batches[i]);
+#ifdef CRYSTAL_USE_SSE
+		else if (useSSE) error = solveBatchSSE(batches[i]);
+#endif
+		else error = solveBatch(batches[i]);
+		if (error > residual) residual = error;
+	}
+	return residual;
+}
+
+/**
+* Solves one axis of one lane of a batch against the velocities of its
+* bodies, held as one array per body of linear and angular velocity.
+* The axis is a template parameter and the components are written out,
+* so each axis compiles to straight code with fixed offsets into the
+* batch. The sums are taken in the same order as the SSE version.
+*/
+template<unsigned a>
+static inline void solveLaneAxis(ContactBatch& batch, unsigned lane,
+	real one[6], real two[6], real& error)
+{
+	const real (&axis)[3][CONTACT_BATCH_LANES] = batch.axis[a];
+	const real (&torqueOne)[3][CONTACT_BATCH_LANES] = batch.torqueAxis[0][a];
+	const real (&torqueTwo)[3][CONTACT_BATCH_LANES] = batch.torqueAxis[1][a];
+
+	// Find the closing velocity along the axis
+	real relative = axis[0][lane] * (one[0] - two[0]);
+	relative += axis[1][lane] * (one[1] - two[1]);
+	relative += axis[2][lane] * (one[2] - two[2]);
+	relative += torqueOne[0][lane] * one[3];
+	relative += torqueOne[1][lane] * one[4];
+	relative += torqueOne[2][lane] * one[5];
+	relative -= torqueTwo[0][lane] * two[3];
+	relative -= torqueTwo[1][lane] * two[4];
+	relative -= torqueTwo[2][lane] * two[5];
+
+	// Clamp the total impulse: the normal impulse may only push the
+	// bodies apart, and the friction impulse stays inside the friction
+	// pyramid of the normal impulse.
+	real old = batch.impulse[a][lane];
+	real total;
+	if (a == 0)
+	{
+		error = batch.targetVelocity[lane] - relative;
+		total = old + error * batch.impulsePerVelocity[a][lane];
+		if (total < 0) total = 0;
+
+		// A contact with no impulse left can only be wrong by closing
+		if (total > 0) error = real_abs(error);
+	}
+	else
+	{
+		real limit = batch.friction[lane] * batch.impulse[0][lane];
+		total = old - relative * batch.impulsePerVelocity[a][lane];
+		if (total > limit) total = limit;
+		else if (total < -limit) total = -limit;
+	}
+	batch.impulse[a][lane] = total;
+
+	// Apply the change in the total impulse. Resting and sliding
+	// contacts often have none, as their impulse stays clamped.
+	real delta = total - old;
+	if (delta == 0) return;
+	const real (&rotationOne)[3][CONTACT_BATCH_LANES] = batch.rotationPerImpulse[0][a];
+	const real (&rotationTwo)[3][CONTACT_BATCH_LANES] = batch.rotationPerImpulse[1][a];
+	real linearOne = delta * batch.inverseMass[0][lane];
+	real linearTwo = delta * batch.inverseMass[1][lane];
+	one[0] += axis[0][lane] * linearOne;
+	one[1] += axis[1][lane] * linearOne;
+	one[2] += axis[2][lane] * linearOne;
+	one[3] += rotationOne[0][lane] * delta;
+	one[4] += rotationOne[1][lane] * delta;
+	one[5] += rotationOne[2][lane] * delta;
+	two[0] -= axis[0][lane] * linearTwo;
+	two[1] -= axis[1][lane] * linearTwo;
+	two[2] -= axis[2][lane] * linearTwo;
+	two[3] -= rotationTwo[0][lane] * delta;
+	two[4] -= rotationTwo[1][lane] * delta;
+	two[5] -= rotationTwo[2][lane] * delta;
+}
+
+real ContactBatchSolver::solveBatch(ContactBatch& batch)
+{
+	real residual = 0;
+	for (unsigned lane = 0; lane < CONTACT_BATCH_LANES; lane++)
+	{
+		// Empty lanes only pad the batch out for the SSE version, and
+		// would solve nothing
+		if (batch.contact[lane] == NO_BATCH_CONTACT) continue;
+
+		// Work on copies of the velocities, so they can be kept in
+		// registers, and store them once the lane is solved
+		BodyVelocity& first = velocities[batch.body[0][lane]];
+		BodyVelocity& second = velocities[batch.body[1][lane]];
+		real one[6] = { first.velocity.x, first.velocity.y, first.velocity.z,
+			first.rotation.x, first.rotation.y, first.rotation.z };
+		real two[6] = { second.velocity.x, second.velocity.y, second.velocity.z,
+			second.rotation.x, second.rotation.y, second.rotation.z };
+
+		// Solve the two friction axes first, then the normal
+		real error = 0;
+		solveLaneAxis<1>(batch, lane, one, two, error);
+		solveLaneAxis<2>(batch, lane, one, two, error);
+		solveLaneAxis<0>(batch, lane, one, two, error);
+		if (error > residual) residual = error;
+
+		first.velocity = Vector3(one[0], one[1], one[2]);
+		first.rotation = Vector3(one[3], one[4], one[5]);
+		second.velocity = Vector3(two[0], two[1], two[2]);
+		second.rotation = Vector3(two[3], two[4], two[5]);
+	}
+	return residual;
+}
+
+real ContactBatchSolver::solvePushBatch(ContactBatch& batch)
+{
+	real residual = 0;
+	for (unsigned lane = 0; lane < CONTACT_BATCH_LANES; lane++)
+	{
+		BodyVelocity& one = pushVelocities[batch.body[0][lane]];
+		BodyVelocity& two = pushVelocities[batch.body[1][lane]];
+
+		// Find the pseudo velocity pushing the contact apart
+		real velocity = 0;
+		for (unsigned c = 0; c < 3; c++)
+		{
+			velocity += batch.axis[0][c][lane] * (one.velocity[c] - two.velocity[c]);
+			velocity += batch.torqueAxis[0][0][c][lane] * one.rotation[c];
+			velocity -= batch.torqueAxis[1][0][c][lane] * two.rotation[c];
+		}
+
+		// The pseudo impulse may only push, like the normal impulse
+		real error = batch.pushVelocity[lane] - velocity;
+		real old = batch.pushImpulse[lane];
+		real total = old + error * batch.impulsePerVelocity[0][lane];
+		if (total < 0) total = 0;
+		batch.pushImpulse[lane] = total;
+
+		if (total > 0) error = real_abs(error);
+		if (error > residual && batch.contact[lane] != NO_BATCH_CONTACT) residual = error;
+
+		real delta = total - old;
+		for (unsigned c = 0; c < 3; c++)
+		{
+			one.velocity[c] += batch.axis[0][c][lane] * (delta * batch.inverseMass[0][lane]);
+			one.rotation[c] += batch.rotationPerImpulse[0][0][c][lane] * delta;
+			two.velocity[c] -= batch.axis[0][c][lane] * (delta * batch.inverseMass[1][lane]);
+			two.rotation[c] -= batch.rotationPerImpulse[1][0][c][lane] * delta;
+		}
+	}
+	return residual;
+}
+
+#ifdef CRYSTAL_USE_SSE
+real ContactBatchSolver::solveBatchSSE(ContactBatch& batch)
+{
+	static_assert(CONTACT_BATCH_LANES == 4, "the SSE solver takes four lanes at a time");
+
+	// Load the velocities of the lanes and turn them into one register
+	// per component. The fourth register holds the padding.
+	__m128 velocity[2][4], rotation[2][4];
+	for (unsigned b = 0; b < 2; b++)
+	{
+		for (unsigned lane = 0; lane < 4; lane++)
+		{
+			BodyVelocity& body = velocities[batch.body[b][lane]];
+			velocity[b][lane] = _mm_loadu_ps(&body.velocity.x);
+			rotation[b][lane] = _mm_loadu_ps(&body.rotation.x);
+		}
+		_MM_TRANSPOSE4_PS(velocity[b][0], velocity[b][1], velocity[b][2], velocity[b][3]);
+		_MM_TRANSPOSE4_PS(rotation[b][0], rotation[b][1], rotation[b][2], rotation[b][3]);
+	}
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	__m128 error = zero;
+	__m128 inverseMass[2] = {
+		_mm_loadu_ps(batch.inverseMass[0]),
+		_mm_loadu_ps(batch.inverseMass[1])
+	};
+
+	// Solve the two friction axes first, then the normal
+	for (unsigned k = 0; k < 3; k++)
+	{
+		unsigned a = (k + 1) % 3;
+
+		__m128 axis[3], torqueAxis[2][3];
+		for (unsigned c = 0; c < 3; c++)
+		{
+			axis[c] = _mm_loadu_ps(batch.axis[a][c]);
+			torqueAxis[0][c] = _mm_loadu_ps(batch.torqueAxis[0][a][c]);
+			torqueAxis[1][c] = _mm_loadu_ps(batch.torqueAxis[1][a][c]);
+		}
+
+		// Find the closing velocity along the axis
+		__m128 relative = zero;
+		for (unsigned c = 0; c < 3; c++)
+		{
+			relative = _mm_add_ps(relative, _mm_mul_ps(axis[c], _mm_sub_ps(velocity[0][c], velocity[1][c])));
+		}
+		for (unsigned c = 0; c < 3; c++)
+		{
+			relative = _mm_add_ps(relative, _mm_mul_ps(torqueAxis[0][c], rotation[0][c]));
+		}
+		for (unsigned c = 0; c < 3; c++)
+		{
+			relative = _mm_sub_ps(relative, _mm_mul_ps(torqueAxis[1][c], rotation[1][c]));
+		}
+
+		// Clamp the total impulse
+		__m128 old = _mm_loadu_ps(batch.impulse[a]);
+		__m128 impulsePerVelocity = _mm_loadu_ps(batch.impulsePerVelocity[a]);
+		__m128 total;
+		if (a == 0)
+		{
+			__m128 target = _mm_loadu_ps(batch.targetVelocity);
+			error = _mm_sub_ps(target, relative);
+			total = _mm_add_ps(old, _mm_mul_ps(error, impulsePerVelocity));
+			total = _mm_max_ps(total, zero);
+
+			// A contact with no impulse left can only be wrong by closing
+			__m128 pushing = _mm_cmpgt_ps(total, zero);
+			error = _mm_or_ps(_mm_and_ps(pushing, _mm_andnot_ps(signMask, error)),
+				_mm_andnot_ps(pushing, error));
+		}
+		else
+		{
+			__m128 limit = _mm_mul_ps(_mm_loadu_ps(batch.friction), _mm_loadu_ps(batch.impulse[0]));
+			total = _mm_sub_ps(old, _mm_mul_ps(relative, impulsePerVelocity));
+			total = _mm_min_ps(total, limit);
+			total = _mm_max_ps(total, _mm_xor_ps(limit, signMask));
+		}
+		_mm_storeu_ps(batch.impulse[a], total);
+
+		// Apply the change in the total impulse
+		__m128 delta = _mm_sub_ps(total, old);
+		__m128 linear[2] = {
+			_mm_mul_ps(delta, inverseMass[0]),
+			_mm_mul_ps(delta, inverseMass[1])
+		};
+		for (unsigned c = 0; c < 3; c++)
+		{
+			velocity[0][c] = _mm_add_ps(velocity[0][c], _mm_mul_ps(axis[c], linear[0]));
+			rotation[0][c] = _mm_add_ps(rotation[0][c],
+				_mm_mul_ps(_mm_loadu_ps(batch.rotationPerImpulse[0][a][c]), delta));
+			velocity[1][c] = _mm_sub_ps(velocity[1][c], _mm_mul_ps(axis[c], linear[1]));
+			rotation[1][c] = _mm_sub_ps(rotation[1][c],
+				_mm_mul_ps(_mm_loadu_ps(batch.rotationPerImpulse[1][a][c]), delta));
+		}
+	}
+
+	// Turn the registers back into one vector per lane and store them
+	for (unsigned b = 0; b < 2; b++)
+	{
+		_MM_TRANSPOSE4_PS(velocity[b][0], velocity[b][1], velocity[b][2], velocity[b][3]);
+		_MM_TRANSPOSE4_PS(rotation[b][0], rotation[b][1], rotation[b][2], rotation[b][3]);
+		for (unsigned lane = 0; lane < 4; lane++)
+		{
+			BodyVelocity& body = velocities[batch.body[b][lane]];
+			_mm_storeu_ps(&body.velocity.x, velocity[b][lane]);
+			_mm_storeu_ps(&body.rotation.x, rotation[b][lane]);
+		}
+	}
+
+	real laneError[4];
+	_mm_storeu_ps(laneError, error);
+	real residual = 0;
+	for (unsigned lane = 0; lane < 4; lane++)
+	{
+		if (laneError[lane] > residual && batch.contact[lane] != NO_BATCH_CONTACT) residual = laneError[lane];
+	}
+	return residual;
+}
+#else
+real ContactBatchSolver::solveBatchSSE(ContactBatch& batch)
+{
+	return solveBatch(batch);
+}
+#endif
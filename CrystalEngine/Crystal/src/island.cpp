@@ -0,0 +1,90 @@
+#include <crystal/island.h>
+
+using namespace crystal;
+
+//Marks a body or a contact with no island
+#define NO_ISLAND 0xffffffff
+
+unsigned IslandBuilder::find(unsigned contact)
+{
+	while (parent[contact] != contact)
+	{
+		parent[contact] = parent[parent[contact]];
+		contact = parent[contact];
+	}
+	return contact;
+}
+
+void IslandBuilder::unite(unsigned one, unsigned two)
+{
+	one = find(one);
+	two = find(two);
+	if (one < two) parent[two] = one;
+	else if (two < one) parent[one] = two;
+}
+
+void IslandBuilder::build(Contact* contacts, unsigned contactCount)
+{
+	islands.clear();
+	contactOrder.clear();
+	parent.resize(contactCount);
+	rootIsland.resize(contactCount);
+
+	// Link every contact to the last contact found on each of its bodies
+	for (unsigned i = 0; i < contactCount; i++)
+	{
+		parent[i] = i;
+		for (unsigned j = 0; j < 2; j++)
+		{
+			RigidBody* body = contacts[i].body[j];
+			if (!isDynamic(body)) continue;
+
+			unsigned last = bodyContact.get(body);
+			if (last != NO_BODY_INDEX) unite(i, last);
+			bodyContact.set(body, i);
+		}
+	}
+
+	// Number the islands in the order of their roots, counting their contacts
+	for (unsigned i = 0; i < contactCount; i++)
+	{
+		rootIsland[i] = NO_ISLAND;
+		if (!isDynamic(contacts[i].body[0]) && !isDynamic(contacts[i].body[1])) continue;
+
+		unsigned root = find(i);
+		if (root == i)
+		{
+			rootIsland[i] = islands.size();
+			ContactIsland island = { 0, 0 };
+			islands.push_back(island);
+		}
+		islands[rootIsland[root]].contactCount++;
+	}
+
+	// Place the contacts island by island
+	unsigned first = 0;
+	for (auto& island : islands)
+	{
+		island.firstContact = first;
+		first += island.contactCount;
+		island.contactCount = 0;
+	}
+	contactOrder.resize(first);
+	for (unsigned i = 0; i < contactCount; i++)
+	{
+		if (!isDynamic(contacts[i].body[0]) && !isDynamic(contacts[i].body[1])) continue;
+
+		ContactIsland& island = islands[rootIsland[find(i)]];
+		contactOrder[island.firstContact + island.contactCount++] = i;
+	}
+
+	// Clear the bodies for the next frame
+	for (unsigned i = 0; i < contactCount; i++)
+	{
+		for (unsigned j = 0; j < 2; j++)
+		{
+			RigidBody* body = contacts[i].body[j];
+			if (isDynamic(body)) bodyContact.clear(body);
+		}
+	}
+}
@@ -16,6 +16,10 @@ glm::mat4 Box::getModelMatrix()
 	*Since the matrix transform is performed in reversed order,
 	*We calculate translation matrix first,then rotation and lastly scaling
 	*/
+	//Draw the box between its last two steps, where the frame has reached
+	crystal::real alpha = world ? world->getInterpolationFactor() : 1;
+	crystal::Vector3 position = getInterpolatedPosition(alpha);
+	crystal::Quaternion orientation = getInterpolatedOrientation(alpha);
 	//Translation
 	glm::vec3 glPosition(position.x, position.y, position.z);
 	model = glm::translate(model, glPosition);
@@ -41,6 +45,7 @@ glm::mat4 Plane::getModelMatrix()
 {
 	glm::mat4 model;
 	//Translation
+	crystal::Vector3 position = getPosition();
 	//glm::vec3 glPosition(position.x, position.y - (PLANE_THICKNESS / 2.0f), position.z);
 	glm::vec3 glPosition(position.x, position.y, position.z);
 	model = glm::translate(model, glPosition);
@@ -0,0 +1,152 @@
+#include <crystal/workers.h>
+
+using namespace crystal;
+
+WorkerPool::WorkerPool(unsigned workerCount):
+	workerCount(workerCount > 0 ? workerCount : 1),
+	batchCount(0), busyThreads(0), stopping(false), taskFunction(NULL)
+{
+	queues = new TaskQueue[this->workerCount];
+	for (unsigned i = 1; i < this->workerCount; i++)
+	{
+		threads.emplace_back(&WorkerPool::threadLoop, this, i);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(batchLock);
+		stopping = true;
+	}
+	batchStarted.notify_all();
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+	delete[] queues;
+}
+
+bool WorkerPool::nextTask(unsigned worker, unsigned& task)
+{
+	// Take the next task of our own
+	{
+		TaskQueue& queue = queues[worker];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if (queue.front < queue.back)
+		{
+			task = queue.tasks[queue.front++];
+			return true;
+		}
+	}
+
+	// Steal the last task of another worker
+	for (unsigned i = 1; i < workerCount; i++)
+	{
+		TaskQueue& queue = queues[(worker + i) % workerCount];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if (queue.front < queue.back)
+		{
+			task = queue.tasks[--queue.back];
+			return true;
+		}
+	}
+	return false;
+}
+
+void WorkerPool::work(unsigned worker)
+{
+	unsigned task;
+	while (nextTask(worker, task))
+	{
+		(*taskFunction)(task, worker);
+	}
+}
+
+void WorkerPool::threadLoop(unsigned worker)
+{
+	unsigned lastBatch = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> guard(batchLock);
+			batchStarted.wait(guard, [&] { return stopping || batchCount != lastBatch; });
+			if (stopping) return;
+			lastBatch = batchCount;
+		}
+
+		work(worker);
+
+		{
+			std::lock_guard<std::mutex> guard(batchLock);
+			busyThreads--;
+		}
+		batchFinished.notify_one();
+	}
+}
+
+void WorkerPool::run(const std::vector<unsigned>& tasks, const TaskFunction& function)
+{
+	// Deal the tasks to the workers in turn
+	for (unsigned i = 0; i < workerCount; i++)
+	{
+		TaskQueue& queue = queues[i];
+		queue.tasks.clear();
+		for (unsigned j = i; j < tasks.size(); j += workerCount)
+		{
+			queue.tasks.push_back(tasks[j]);
+		}
+		queue.front = 0;
+		queue.back = queue.tasks.size();
+	}
+	taskFunction = &function;
+
+	if (workerCount > 1)
+	{
+		{
+			std::lock_guard<std::mutex> guard(batchLock);
+			busyThreads = workerCount - 1;
+			batchCount++;
+		}
+		batchStarted.notify_all();
+	}
+
+	work(0);
+
+	if (workerCount > 1)
+	{
+		std::unique_lock<std::mutex> guard(batchLock);
+		batchFinished.wait(guard, [&] { return busyThreads == 0; });
+	}
+	taskFunction = NULL;
+}
+
+void WorkerPool::runRange(unsigned count, unsigned minimumChunk,
+	const RangeFunction& function, unsigned alignment)
+{
+	if (count == 0) return;
+
+	// Aim for a few chunks per worker, but none smaller than the minimum
+	unsigned chunk = (count + workerCount * RANGE_TASKS_PER_WORKER - 1) /
+		(workerCount * RANGE_TASKS_PER_WORKER);
+	if (chunk < minimumChunk) chunk = minimumChunk;
+	chunk = (chunk + alignment - 1) / alignment * alignment;
+
+	if (workerCount == 1 || chunk >= count)
+	{
+		function(0, count);
+		return;
+	}
+
+	rangeTasks.clear();
+	for (unsigned first = 0; first < count; first += chunk)
+	{
+		rangeTasks.push_back(first);
+	}
+
+	run(rangeTasks, [&](unsigned first, unsigned)
+	{
+		unsigned last = first + chunk;
+		function(first, last < count ? last : count);
+	});
+}
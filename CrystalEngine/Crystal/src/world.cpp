@@ -1,66 +1,312 @@
 #include<crystal/world.h>
+#include <algorithm>
 
 using namespace crystal;
 
+/**
+* Gets the index of the shape types of a pair in the dispatch table.
+*/
+static inline unsigned getPairType(const PotentialContact& pair)
+{
+	return pair.collider[0]->getShapeType() * CollisionDispatcher::size + pair.collider[1]->getShapeType();
+}
+
 World::World(unsigned maxContacts, unsigned iterations):
 	resolver(maxContacts*iterations),
+	workers(NULL), resolverBudget(0), resolverStats(),
+	stepDuration(((real)1) / DEFAULT_STEP_RATE), maxSubSteps(DEFAULT_MAX_SUB_STEPS),
+	stepAccumulator(0), droppedTime(0),
 	firstContactGen(NULL),
 	maxContacts(maxContacts), bodyCount(0),activeBodyCount(0),
-	colliders(),collectGap(DEFAULT_COLLECT_GAP),collisionCallbacks(0),indexList(0)
+	colliders(),collectGap(DEFAULT_COLLECT_GAP), contactLimit(0), contactOverflows(0), droppedPairs(0),
+	broadphase(new AABBTreeBroadphase()), broadphaseType(BROADPHASE_AABB_TREE),
+	gridCellSize(DEFAULT_GRID_CELL_SIZE),
+	worldSize(DEFAULT_WORLD_EXTENT, DEFAULT_WORLD_EXTENT, DEFAULT_WORLD_EXTENT)
 {
 	contacts = new Contact[maxContacts];
+	contactPoints.resize(maxContacts);
+	frameCount = 0;
 	calculateIterations = (iterations == 0);
+	iterationsPerContact = iterations;
 	cData.contactArray = contacts;
+	resolver.setWarmStartFactor(DEFAULT_WARM_START_FACTOR);
 }
 
 World::~World() 
 {
 	delete[] contacts;
+	delete broadphase;
+	delete workers;
+}
+
+World::CollisionCallback& World::getCallback(CollisionPrimitive* collider)
+{
+	CollisionCallback* callback = collisionCallbacks.get(collider->callback);
+	if (callback) return *callback;
+
+	CollisionCallback empty = { NULL, NULL };
+	collider->callback = collisionCallbacks.add(empty);
+	return *collisionCallbacks.get(collider->callback);
 }
 
 void World::addCallbackMethod(RigidBody* body, CallbackMethod(method))
 {
 	CollisionPrimitive* collider = getAttachedCollider(body);
-	unsigned currentIndex = collisionCallbacks.size();
-	collisionCallbacks.push_back(method);
-	ColliderCallbackIndex index;
-	index.collider = collider;
-	index.index = currentIndex;
-	indexList.push_back(index);
+	if (collider) getCallback(collider).onCollision = method;
+}
+
+void World::addEventMethod(RigidBody* body, EventMethod(method))
+{
+	CollisionPrimitive* collider = getAttachedCollider(body);
+	if (collider) getCallback(collider).onEvent = method;
+}
+
+void World::addEvent(CollisionEventType type, CollisionPrimitive* one, CollisionPrimitive* two, unsigned contactCount)
+{
+	CollisionEvent event;
+	event.type = type;
+	event.collider[0] = one;
+	event.collider[1] = two;
+	event.contactCount = contactCount;
+	collisionEvents.push_back(event);
+}
+
+void World::dispatchEvents()
+{
+	// Callbacks may add callbacks, so the list is read by index and
+	// each callback copied before it is called
+	for (unsigned i = 0; i < collisionEvents.size(); i++)
+	{
+		const CollisionEvent event = collisionEvents[i];
+		for (unsigned j = 0; j < 2; j++)
+		{
+			CollisionPrimitive* collider = event.collider[j];
+			CollisionPrimitive* other = event.collider[1 - j];
+			const CollisionCallback* found = collisionCallbacks.get(collider->callback);
+			if (!found) continue;
+			CollisionCallback callback = *found;
+
+			if (callback.onEvent) callback.onEvent(this, event, collider, other);
+			if (callback.onCollision && event.type != COLLISION_END && collider->isActive && other->isActive)
+			{
+				callback.onCollision(this, collider, other);
+			}
+		}
+	}
 }
 
 void World::startFrame()
 {
-	for (auto body: bodyList)
+	bodyStore.startFrame(workers);
+	updateColliders();
+}
+
+void World::updateColliders()
+{
+	auto updateRange = [this](unsigned first, unsigned last)
+	{
+		for (unsigned i = first; i < last; i++)
+		{
+			CollisionPrimitive* collider = colliders[i].get();
+			if (!collider->isActive) continue;
+			if (collider->body && !collider->body->getAwake()) continue;
+			collider->calculateInternals();
+		}
+	};
+	if (workers)
+	{
+		workers->runRange(colliders.size(), COLLIDERS_PER_TASK, updateRange);
+	}
+	else
+	{
+		updateRange(0, colliders.size());
+	}
+}
+
+ColliderHandle World::addCollider(CollisionPrimitive* collider)
+{
+	ColliderHandle handle = colliders.add(ColliderPtr(collider));
+	collider->handle = handle;
+	addToSet(collider);
+	return handle;
+}
+
+void World::addToSet(CollisionPrimitive* collider)
+{
+	ColliderSet set = getColliderSet(collider);
+	colliderSets[collider] = set;
+	switch (set)
+	{
+	case COLLIDER_STATIC:
+		staticSet.add(collider);
+		break;
+	case COLLIDER_DORMANT:
+		dormantSet.add(collider);
+		break;
+	default:
+		broadphase->add(collider);
+		break;
+	}
+}
+
+bool World::isResting(CollisionPrimitive* collider)
+{
+	return collider->isActive && colliderSets[collider] != COLLIDER_DYNAMIC;
+}
+
+bool World::isStatic(CollisionPrimitive* collider)
+{
+	if (collider->getShapeType() == PLANE_TAG) return true;
+	return !collider->body || collider->body->getInverseMass() == 0;
+}
+
+World::ColliderSet World::getColliderSet(CollisionPrimitive* collider)
+{
+	if (isStatic(collider)) return COLLIDER_STATIC;
+	if (collider->body && !collider->body->getAwake()) return COLLIDER_DORMANT;
+	return COLLIDER_DYNAMIC;
+}
+
+BoundingBox World::getQueryBox(CollisionPrimitive* collider)
+{
+	BoundingBox box;
+	if (BoundingBox::fromPrimitive(*collider, &box))
+	{
+		box.fatten(DEFAULT_AABB_MARGIN);
+		return box;
+	}
+	// Unbounded dynamic colliders have to be checked against everything
+	return BoundingBox(Vector3(), Vector3(REAL_MAX, REAL_MAX, REAL_MAX));
+}
+
+void World::updateColliderSets()
+{
+	for (auto& collider : colliders)
+	{
+		if (!collider->isActive) continue;
+
+		if (colliderSets[collider.get()] != getColliderSet(collider.get()))
+		{
+			removeFromSets(collider.get());
+			addToSet(collider.get());
+		}
+	}
+
+	// Static bodies aren't expected to move, but they may be placed by hand
+	staticSet.update();
+}
+
+void World::wakeOverlapping(CollisionPrimitive* collider)
+{
+	queryResult.clear();
+	dormantSet.query(getQueryBox(collider), queryResult);
+	for (CollisionPrimitive* other : queryResult)
+	{
+		if (!other->isActive || colliderSets[other] != COLLIDER_DORMANT) continue;
+		if (!CollisionPrimitive::shouldCollide(*collider, *other)) continue;
+
+		other->body->setAwake();
+		wokenColliders.push_back(other);
+		dormantSet.remove(other);
+		broadphase->add(other);
+		colliderSets[other] = COLLIDER_DYNAMIC;
+	}
+}
+
+void World::wakeDormantColliders()
+{
+	wokenColliders.clear();
+	for (auto& collider : colliders)
+	{
+		if (!collider->isActive || colliderSets[collider.get()] != COLLIDER_DYNAMIC) continue;
+		wakeOverlapping(collider.get());
+	}
+
+	// The list grows as the woken colliders wake others
+	for (unsigned i = 0; i < wokenColliders.size(); i++)
+	{
+		wakeOverlapping(wokenColliders[i]);
+	}
+}
+
+void World::getStaticContacts()
+{
+	PotentialContact contact;
+	for (auto& collider : colliders)
+	{
+		CollisionPrimitive* current = collider.get();
+		if (!current->isActive || colliderSets[current] != COLLIDER_DYNAMIC) continue;
+
+		queryResult.clear();
+		staticSet.query(getQueryBox(current), queryResult);
+
+		contact.collider[0] = current;
+		for (CollisionPrimitive* other : queryResult)
+		{
+			if (!other->isActive || !CollisionPrimitive::shouldCollide(*current, *other)) continue;
+			contact.collider[1] = other;
+			potentialContacts.push_back(contact);
+		}
+	}
+}
+
+void World::setBroadphase(BroadphaseType type, real cellSize)
+{
+	delete broadphase;
+	broadphaseType = type;
+	gridCellSize = cellSize;
+	switch (type)
 	{
-		body->clearAccumulators();
-		body->calculateDerivedData();
+	case BROADPHASE_BRUTE_FORCE:
+		broadphase = new BruteForceBroadphase();
+		break;
+	case BROADPHASE_SWEEP_AND_PRUNE:
+		broadphase = new SweepAndPruneBroadphase();
+		break;
+	case BROADPHASE_SPATIAL_GRID:
+		broadphase = new SpatialGridBroadphase(worldSize, cellSize);
+		break;
+	case BROADPHASE_AABB_TREE:
+	default:
+		broadphase = new AABBTreeBroadphase();
+		break;
 	}
 
 	for (auto collider : colliders)
 	{
-		if (collider->isActive)
-			collider->calculateInternals();
+		if (colliderSets[collider.get()] == COLLIDER_DYNAMIC)
+			broadphase->add(collider.get());
 	}
 }
 
-void World::addCollider(CollisionPrimitive* collider)
+void World::setWorldSize(const Vector3& size)
 {
-	colliders.emplace_back(collider);
+	worldSize = size;
+	if (broadphaseType == BROADPHASE_SPATIAL_GRID)
+	{
+		setBroadphase(broadphaseType, gridCellSize);
+	}
 }
 
-void World::addRigidBody(RigidBody* const body,CollisionPrimitive* const collider)
+BodyHandle World::addRigidBody(RigidBody* const body,CollisionPrimitive* const collider)
 {
 	bodyCount++;
 	activeBodyCount++;
 
-	bodyList.emplace_back(body);
+	BodyHandle handle = bodyList.add(BodyPtr(body));
+	body->handle = handle;
+	bodyStore.adopt(body);
+	// A new body has no earlier state to interpolate from
+	bodyStore.saveState(body);
 
 	if (collider)
 	{
+		// Link the body and the collider both ways
+		collider->body = body;
+		body->collider = collider;
 		addCollider(collider);
-		bodyColliderReg.emplace_back(body->getId(), collider->getId());
-	}	
+	}
+	return handle;
 }
 
 void World::runPhysics(real duration)
@@ -69,21 +315,221 @@ void World::runPhysics(real duration)
 	forceRegistry.updateForces(duration);
 
 	//Integrate bodies
-	for (auto body : bodyList)
-	{
-		body->integrate(duration);
-	}
+	bodyStore.integrate(duration, workers);
 
 	// Generate contacts
-	unsigned usedContacts = generateContacts();
+	generateContacts();
+
+	// Lay the contacts out island by island, so each island can be
+	// passed to the resolver on its own. Contacts between bodies that
+	// can't move belong to no island and are skipped.
+	islands.build(cData.contactArray, cData.contactCount);
+	const std::vector<unsigned>& contactOrder = islands.getContactOrder();
+	if (islandContacts.size() < contactOrder.size()) islandContacts.resize(contactOrder.size());
+	for (unsigned i = 0; i < contactOrder.size(); i++)
+	{
+		islandContacts[i] = cData.contactArray[contactOrder[i]];
+	}
 
 	// And process them
-	if (calculateIterations) resolver.setIterations(usedContacts * 4);
-	resolver.resolveContacts(cData.contactArray, cData.contactCount, duration);
+	resolveIslands(duration);
+
+	// Store the impulses in the manifolds for the next frame
+	for (unsigned i = 0; i < contactOrder.size(); i++)
+	{
+		contactPoints[contactOrder[i]]->accumulatedImpulse = islandContacts[i].accumulatedImpulse;
+	}
+
+	updateSleep();
+
+	// Now the step is done, let the callbacks see what collided
+	dispatchEvents();
+}
+
+unsigned World::step(real frameDuration)
+{
+	stepAccumulator += frameDuration;
+	unsigned steps = (unsigned)(stepAccumulator / stepDuration);
+	if (steps > maxSubSteps)
+	{
+		// Drop the steps there is no time for
+		droppedTime += (steps - maxSubSteps) * stepDuration;
+		stepAccumulator -= (steps - maxSubSteps) * stepDuration;
+		steps = maxSubSteps;
+	}
+
+	for (unsigned i = 0; i < steps; i++)
+	{
+		// Keep the state before the last step, to interpolate from
+		if (i + 1 == steps) bodyStore.saveState(workers);
+
+		// startFrame brought the colliders up to date for the first
+		// step, later ones follow the bodies moved by the step before
+		if (i > 0) updateColliders();
+		runPhysics(stepDuration);
+		stepAccumulator -= stepDuration;
+	}
+
+	// Rounding may leave the accumulator just below zero
+	if (stepAccumulator < 0) stepAccumulator = 0;
+	return steps;
+}
+
+void World::updateSleep()
+{
+	// Find the awake bodies that have been still for long enough. The
+	// bodies of the world are marked by their slot in its store
+	readyToSleep.assign(bodyStore.getBodyCount(), false);
+	for (auto& body : bodyList)
+	{
+		readyToSleep[body->getSlot()] = body->isActive && body->getAwake() && body->getCanSleep() &&
+			body->getMotion() < getSleepEpsilon();
+	}
+
+	// Keep the whole island awake if one of its bodies isn't ready
+	for (unsigned i = 0; i < islands.getIslandCount(); i++)
+	{
+		const ContactIsland& island = islands.getIsland(i);
+		Contact* first = &islandContacts[island.firstContact];
+		Contact* last = first + island.contactCount;
+
+		bool ready = true;
+		for (Contact* contact = first; contact < last && ready; contact++)
+		{
+			for (unsigned j = 0; j < 2; j++)
+			{
+				RigidBody* body = contact->body[j];
+				if (body && body->hasFiniteMass() && !isReadyToSleep(body)) ready = false;
+			}
+		}
+		if (ready) continue;
+
+		for (Contact* contact = first; contact < last; contact++)
+		{
+			for (unsigned j = 0; j < 2; j++)
+			{
+				RigidBody* body = contact->body[j];
+				if (body && body->hasFiniteMass() && body->getStore() == &bodyStore) readyToSleep[body->getSlot()] = false;
+			}
+		}
+	}
+
+	for (auto& body : bodyList)
+	{
+		if (readyToSleep[body->getSlot()]) body->setAwake(false);
+	}
+}
+
+void World::resolveIsland(unsigned index, ContactResolver& islandResolver, real duration)
+{
+	const ContactIsland& island = islands.getIsland(index);
+	unsigned iterations = calculateIterations ? 4 : iterationsPerContact;
+	islandResolver.setIterations(island.contactCount * iterations);
+
+	// Share the budget out by contacts, giving every island some time
+	unsigned budget = 0;
+	if (resolverBudget > 0)
+	{
+		unsigned long long share = (unsigned long long)resolverBudget * island.contactCount / islands.getContactOrder().size();
+		budget = share > 0 ? (unsigned)share : 1;
+	}
+	islandResolver.setTimeBudget(budget);
+
+	islandResolver.resolveContacts(&islandContacts[island.firstContact], island.contactCount, duration);
+
+	ResolverStats& stats = islandStats[index];
+	stats.velocityIterations = islandResolver.velocityIterationsUsed;
+	stats.positionIterations = islandResolver.positionIterationsUsed;
+	stats.velocityResidual = islandResolver.velocityResidual;
+	stats.positionResidual = islandResolver.positionResidual;
+	stats.budgetExceeded = islandResolver.budgetExceeded;
+}
+
+void World::resolveIslands(real duration)
+{
+	unsigned islandCount = islands.getIslandCount();
+	islandStats.resize(islandCount);
+
+	if (!workers)
+	{
+		for (unsigned i = 0; i < islandCount; i++)
+		{
+			resolveIsland(i, resolver, duration);
+		}
+	}
+	else
+	{
+		resolveIslandsOnWorkers(duration);
+	}
+
+	// Gather the stats of the islands
+	resolverStats = ResolverStats();
+	for (const auto& stats : islandStats)
+	{
+		resolverStats.velocityIterations += stats.velocityIterations;
+		resolverStats.positionIterations += stats.positionIterations;
+		if (stats.velocityResidual > resolverStats.velocityResidual) resolverStats.velocityResidual = stats.velocityResidual;
+		if (stats.positionResidual > resolverStats.positionResidual) resolverStats.positionResidual = stats.positionResidual;
+		if (stats.budgetExceeded) resolverStats.budgetExceeded = true;
+	}
+}
+
+void World::resolveIslandsOnWorkers(real duration)
+{
+	unsigned islandCount = islands.getIslandCount();
+
+	// Start the largest islands first, so the small ones fill the gaps
+	islandTasks.resize(islandCount);
+	for (unsigned i = 0; i < islandCount; i++)
+	{
+		islandTasks[i] = i;
+	}
+	std::stable_sort(islandTasks.begin(), islandTasks.end(), [this](unsigned a, unsigned b)
+	{
+		return islands.getIsland(a).contactCount > islands.getIsland(b).contactCount;
+	});
+
+	// Each worker resolves with its own resolver, which keeps its
+	// buffers between frames
+	if (workerResolvers.size() != workers->getWorkerCount())
+	{
+		workerResolvers.assign(workers->getWorkerCount(), resolver);
+	}
+	for (auto& workerResolver : workerResolvers)
+	{
+		workerResolver.copySettings(resolver);
+	}
+
+	// A large island would keep one worker busy while the others wait,
+	// so resolve it on its own with its colors shared out instead.
+	unsigned shared = 0;
+	if (resolver.getMode() == RESOLVER_SEQUENTIAL_IMPULSE)
+	{
+		resolver.setWorkers(workers);
+		for (; shared < islandCount; shared++)
+		{
+			if (islands.getIsland(islandTasks[shared]).contactCount < PARALLEL_ISLAND_CONTACTS) break;
+			resolveIsland(islandTasks[shared], resolver, duration);
+		}
+		resolver.setWorkers(NULL);
+	}
+	islandTasks.erase(islandTasks.begin(), islandTasks.begin() + shared);
+
+	workers->run(islandTasks, [&](unsigned task, unsigned worker)
+	{
+		resolveIsland(task, workerResolvers[worker], duration);
+	});
+}
+
+void World::setWorkerCount(unsigned count)
+{
+	delete workers;
+	workers = count > 1 ? new WorkerPool(count) : NULL;
 }
 
 void World::deleteBody(RigidBody* body)
 {
+	if (!body->isActive) return;
 	body->isActive = false;
 	activeBodyCount--;
 	CollisionPrimitive* collider = getAttachedCollider(body);
@@ -93,39 +539,55 @@ void World::deleteBody(RigidBody* body)
 	}
 }
 
+void World::deleteBody(BodyHandle handle)
+{
+	RigidBody* body = getBody(handle);
+	if (body) deleteBody(body);
+}
+
+void World::removeFromSets(CollisionPrimitive* collider)
+{
+	switch (colliderSets[collider])
+	{
+	case COLLIDER_STATIC:
+		staticSet.remove(collider);
+		break;
+	case COLLIDER_DORMANT:
+		dormantSet.remove(collider);
+		break;
+	default:
+		broadphase->remove(collider);
+		break;
+	}
+	colliderSets.erase(collider);
+}
+
 void World::removeInActiveBodies()
 {
 	//No body to remove
 	if (activeBodyCount == bodyCount) return;
 	
 	//Remove inactive colliders
-	for (auto itor = colliders.begin(); itor != colliders.end();)
+	colliders.removeIf([this](const ColliderPtr& collider)
 	{
-		if (!(*itor)->isActive)
-		{
-			itor = colliders.erase(itor);
-		}
-		else
-		{
-			itor++;
-		}
-	}
+		if (collider->isActive) return false;
+		removeFromSets(collider.get());
+		collider->handle = ColliderHandle();
+		retiredColliders.push_back(collider);
+		return true;
+	});
 	
-	//Remove inactive rigidbodies
-	for (auto itor = bodyList.begin(); itor != bodyList.end();)
+	//Remove inactive rigidbodies. Their colliders went with them. The
+	//bodies leave the store of the world, so they are no longer integrated
+	bodyList.removeIf([this](const BodyPtr& body)
 	{
-		if (!(itor->get()->isActive))
-		{
-			itor = bodyList.erase(itor);
-		}
-		else
-		{
-			itor++;
-		}
-	}
-	
-	//We have to reset the body pointer in colliders because the original pointer may have moved
-	resetColliderBodies();
+		if (body->isActive) return false;
+		body->handle = BodyHandle();
+		body->collider = NULL;
+		BodyStore::getLooseStore().adopt(body.get());
+		retiredBodies.push_back(body);
+		return true;
+	});
 
 	bodyCount = activeBodyCount;	
 }
@@ -133,103 +595,219 @@ void World::removeInActiveBodies()
 unsigned World::generateContacts()
 {
 	// Set up the collision data structure
-	cData.reset(maxContacts);
+	cData.reset(contactLimit > 0 && contactLimit < maxContacts ? contactLimit : maxContacts);
+	contactOverflows = 0;
+	droppedPairs = 0;
 	cData.friction = (crystal::real)0.9;
 	cData.restitution = (crystal::real)0.2;
 	cData.tolerance = (crystal::real)0.1;
 	unsigned result = 0;
+
+	// The events of the last step have been dispatched, so the bodies
+	// and colliders removed in it can go
+	collisionEvents.clear();
+	for (auto& collider : retiredColliders)
+	{
+		collisionCallbacks.remove(collider->callback);
+	}
+	retiredColliders.clear();
+	retiredBodies.clear();
+
 	//Trigger body deletion. Remove all inactive bodies and colliders
 	if (bodyCount - activeBodyCount >= collectGap)
 	{
 		removeInActiveBodies();
 	}
 
+	frameCount++;
+
 	// Perform collision detection
-	// The methods in collider_coarse don't work properly for now, so I check all possible contacts instead
-	// TODO: Use workable bounding volumn trees to speed up calculation
+	// Only the pairs reported by the broad phase are checked
+	updateColliderSets();
+	dormantSet.update();
+	wakeDormantColliders();
+	broadphase->update();
+	potentialContacts.clear();
+	broadphase->getPotentialContacts(potentialContacts);
+	// Every pair the broad phase reports is checked each step and the
+	// pair cache tracks which are new, so the changes it records aren't
+	// needed. They are cleared so they don't gather without bound.
+	broadphase->clearPairChanges();
+
+	// Drop the pairs filtered out by their collision layers, so they take
+	// no fine collision detection and no space in the contact array
+	potentialContacts.erase(std::remove_if(potentialContacts.begin(), potentialContacts.end(),
+		[](const PotentialContact& pair)
+	{
+		return !CollisionPrimitive::shouldCollide(*pair.collider[0], *pair.collider[1]);
+	}), potentialContacts.end());
+
+	getStaticContacts();
+
+	// Bucket the pairs by the shape types of their colliders, so each
+	// bucket runs a single collide function. Inside a bucket the pairs are
+	// checked in the order the colliders were created, so that every broad
+	// phase generates the same contacts in the same order.
+	for (auto& pair : potentialContacts)
+	{
+		if (pair.collider[0]->getId() > pair.collider[1]->getId())
+		{
+			std::swap(pair.collider[0], pair.collider[1]);
+		}
+	}
+	std::sort(potentialContacts.begin(), potentialContacts.end(),
+		[](const PotentialContact& a, const PotentialContact& b)
+	{
+		unsigned typeA = getPairType(a), typeB = getPairType(b);
+		if (typeA != typeB)
+			return typeA < typeB;
+		if (a.collider[0]->getId() != b.collider[0]->getId())
+			return a.collider[0]->getId() < b.collider[0]->getId();
+		return a.collider[1]->getId() < b.collider[1]->getId();
+	});
+
 	CollisionPrimitive* currentCollider;
 	CollisionPrimitive* checkCollider;
 
-	for (int i = 0; i < colliders.size(); i++)
-	{	
-		currentCollider = colliders[i].get();
+	unsigned pairCount = potentialContacts.size();
+	for (unsigned start = 0; start < pairCount;)
+	{
+		// Find the end of the bucket and its collide function
+		unsigned pairType = getPairType(potentialContacts[start]);
+		unsigned end = start + 1;
+		while (end < pairCount && getPairType(potentialContacts[end]) == pairType) end++;
+		CollideFunction collide = CollisionDispatcher::getFunction(
+			potentialContacts[start].collider[0]->getShapeType(),
+			potentialContacts[start].collider[1]->getShapeType());
+
+		for (unsigned i = start; i < end; i++)
+		{
+			currentCollider = potentialContacts[i].collider[0];
+			checkCollider = potentialContacts[i].collider[1];
+
+			// A deleted collider is skipped, so its pairs end
+			if (!(currentCollider->isActive) || !(checkCollider->isActive)) continue;
 
-		if (!(currentCollider->isActive)) continue;
+			result += collidePair(collide, currentCollider, checkCollider);
+		}
+		start = end;
+	}
 
-		for (int j = i+1; j < colliders.size(); j++)
+	// Forget the pairs the broad phase no longer reports, ending the
+	// ones that were touching
+	for (auto itor = pairCache.begin(); itor != pairCache.end();)
+	{
+		PairCacheEntry& entry = itor->second;
+		if (entry.lastFrame == frameCount)
 		{
-			//Check contacts with the rest colliders
-			checkCollider = colliders[j].get();
+			itor++;
+			continue;
+		}
 
-			if (!(checkCollider->isActive)) continue;
-			unsigned genCountactNum = CollisionDetector::primitiveCollide(*currentCollider, *checkCollider, &cData);
-			if (genCountactNum > 0)
-			{
-				//Call on collision methods
-				for (int i = 0; i < indexList.size(); i++)
-				{
-					if (indexList[i].collider == currentCollider)
-					{
-						collisionCallbacks[indexList[i].index](this, currentCollider, checkCollider);
-					}
-					else if (indexList[i].collider == checkCollider)
-					{
-						collisionCallbacks[indexList[i].index](this, checkCollider, currentCollider);
-					}
-				}
-			}
-			result += genCountactNum;
+		// A touching pair with no awake dynamic collider is not checked
+		// while it sleeps, but it still touches. Its points are dropped
+		// as if the pair was new, and checked again when it wakes.
+		if (entry.touching && isResting(entry.collider[0]) && isResting(entry.collider[1]))
+		{
+			entry.manifold = ContactManifold();
+			entry.separatingAxis = NO_SEPARATING_AXIS;
+			itor++;
+			continue;
 		}
+
+		if (entry.touching) addEvent(COLLISION_END, entry.collider[0], entry.collider[1], 0);
+		itor = pairCache.erase(itor);
 	}
 
 	return result;
 }
 
-CollisionPrimitive* World::getAttachedCollider(RigidBody* body)
+unsigned World::collidePair(CollideFunction collide, CollisionPrimitive* one, CollisionPrimitive* two)
 {
-	unsigned cid = -1;
-	for (auto reg : bodyColliderReg)
+	PairCacheEntry& entry = pairCache[((unsigned long long)one->getId() << 32) | two->getId()];
+	entry.lastFrame = frameCount;
+	entry.collider[0] = one;
+	entry.collider[1] = two;
+	ContactManifold& manifold = entry.manifold;
+
+	if (!reserveContacts(MAX_PAIR_CONTACTS))
 	{
-		if (reg.bodyId == body->getId())
+		// Check the pair with the room that is left, so the manifold
+		// is only cleared when the pair is really separated
+		contactOverflows++;
+		if (cData.contactsLeft <= 0)
 		{
-			cid = reg.colliderId;
+			// No room to check the pair at all. A touching pair is
+			// taken to still touch and keeps its manifold for the next
+			// frame, but gives the resolver no contacts in this one
+			droppedPairs++;
+			if (entry.touching) addEvent(COLLISION_PERSIST, one, two, 0);
+			return 0;
 		}
 	}
-	if (cid == -1)
-		return nullptr;
 
-	for (auto collider : colliders)
+	Contact* first = cData.contacts;
+	cData.cachedAxis = &entry.separatingAxis;
+	unsigned found = collide(*one, *two, &cData);
+	cData.cachedAxis = NULL;
+	if (found == 0)
 	{
-		if (collider->getId() == cid)
-		{
-			return collider.get();
-		}
+		// The pair is separated, the cached points are no longer valid
+		manifold.pointCount = 0;
+		if (entry.touching) addEvent(COLLISION_END, one, two, 0);
+		entry.touching = false;
+		return 0;
+	}
+
+	// Merge the new contacts into the manifold, then replace them
+	// with the points of the manifold
+	manifold.refresh();
+	for (unsigned i = 0; i < found; i++)
+	{
+		manifold.addContact(first[i]);
 	}
-	return nullptr;
+
+	cData.contacts = first;
+	cData.contactsLeft += found;
+	cData.contactCount -= found;
+	unsigned written = manifold.writeContacts(first, cData.contactsLeft, cData.friction, cData.restitution,
+		&contactPoints[cData.contactCount]);
+	cData.addContacts(written);
+
+	addEvent(entry.touching ? COLLISION_PERSIST : COLLISION_BEGIN, one, two, written);
+	entry.touching = true;
+	return written;
 }
 
-void World::resetColliderBodies()
+CollisionPrimitive* World::getAttachedCollider(RigidBody* body)
+{
+	// The handle may be for another world
+	BodyPtr* entry = bodyList.get(body->handle);
+	if (!entry || entry->get() != body) return nullptr;
+	return body->collider;
+}
+
+bool World::reserveContacts(unsigned count)
 {
-	for (auto c : colliders)
+	if (cData.contactsLeft >= (int)count) return true;
+
+	// Grow to at least twice the size, so the array settles quickly
+	unsigned capacity = cData.contactCount + count;
+	if (capacity < maxContacts * 2) capacity = maxContacts * 2;
+	if (contactLimit > 0 && capacity > contactLimit) capacity = contactLimit;
+
+	if (capacity > maxContacts)
 	{
-		//Get body id
-		unsigned bid = -1;
-		for (auto reg : bodyColliderReg)
-		{
-			if (reg.colliderId == c->getId())
-			{
-				bid = reg.bodyId;
-				break;
-			}				
-		}
-		//find body
-		for (auto b : bodyList)
-		{
-			if (b->getId() == bid)
-			{
-				c->body = b.get();
-				break;
-			}
-		}
+		Contact* grown = new Contact[capacity];
+		std::copy(contacts, contacts + cData.contactCount, grown);
+		delete[] contacts;
+		contacts = grown;
+		contactPoints.resize(capacity);
+
+		cData.contactArray = contacts;
+		cData.contacts = contacts + cData.contactCount;
+		cData.contactsLeft += capacity - maxContacts;
+		maxContacts = capacity;
 	}
-}
\ No newline at end of file
+	return cData.contactsLeft >= (int)count;
+}
@@ -0,0 +1,39 @@
+/**
+* Times the worst-first contact resolver on box piles of growing size,
+* from a few hundred contacts to over ten thousand. After each contact
+* is resolved, only the contacts listed for its two bodies are updated,
+* so the time per contact should stay about the same as the pile
+* grows. Updating every contact in the set would make it grow with the
+* number of contacts.
+*
+* Built by body_contacts_bench.vcxproj with the engine sources, without
+* the graphics, and run after each build. Returns 0 if every run leaves
+* the bodies at finite positions, so a blown up pile fails the build.
+*/
+#include "box_pile.h"
+#include <cstdio>
+
+#define RUN_COUNT 5
+
+int main()
+{
+	// Width, height and depth of each pile
+	const unsigned piles[][3] = { { 4, 4, 4 }, { 6, 8, 6 }, { 10, 10, 10 }, { 10, 20, 10 } };
+
+	bool finite = true;
+	printf("  boxes  contacts        ms  us/contact\n");
+	for (auto& size : piles)
+	{
+		BoxPile pile(size[0], size[1], size[2]);
+		ContactResolver resolver(pile.getContactCount() * 4);
+		double time = timeResolve(pile, RUN_COUNT, [&](Contact* contacts, unsigned count)
+		{
+			resolver.resolveContacts(contacts, count, PILE_STEP);
+		});
+		finite = finite && pile.isFinite();
+
+		printf("%7u %9u %9.3f %11.3f\n", pile.getBodyCount(), pile.getContactCount(),
+			time, time * 1000 / pile.getContactCount());
+	}
+	return finite ? 0 : 1;
+}
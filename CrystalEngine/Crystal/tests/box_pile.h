@@ -0,0 +1,204 @@
+#pragma once
+#include <crystal\crystal.h>
+#include <chrono>
+#include <vector>
+
+using namespace crystal;
+
+//The time step the contacts of a pile are resolved for
+#define PILE_STEP ((real)1 / 60)
+
+/**
+* A pile of unit boxes on the ground, laid out in a grid of columns
+* that press into each other and the ground, with the contacts between
+* them. Each box is nudged and turned a little, so the pile isn't
+* perfectly regular, and falls at the speed one step of gravity gives.
+*
+* The contact resolver changes the bodies and the contacts, so restore
+* the pile before each run.
+*/
+class BoxPile
+{
+protected:
+	std::vector<RigidBody> bodies;
+	std::vector<CollisionBox> boxes;
+	RigidBody groundBody;
+	CollisionPlane ground;
+
+	//Hold the generated contacts, and the copy the resolver works on
+	std::vector<Contact> contacts;
+	std::vector<Contact> working;
+
+	//Hold the starting state of each body
+	std::vector<Vector3> positions;
+	std::vector<Quaternion> orientations;
+
+public:
+	BoxPile(unsigned width, unsigned height, unsigned depth)
+		:bodies(width * height * depth), boxes(width * height * depth)
+	{
+		Random::SetSeed(1);
+		Vector3 halfSize(0.5f, 0.5f, 0.5f);
+		Matrix3 tensor;
+		tensor.setBlockInertiaTensor(halfSize, 1);
+
+		unsigned index = 0;
+		for (unsigned x = 0; x < width; x++) for (unsigned z = 0; z < depth; z++) for (unsigned y = 0; y < height; y++)
+		{
+			RigidBody& body = bodies[index];
+			body.setMass(1);
+			body.setInertiaTensor(tensor);
+			body.setDamping(0.98f, 0.8f);
+
+			// Each box sinks a hundredth into the one below it
+			Vector3 position(x + Random::getRandom(-0.02f, 0.02f), 0.49f + y * 0.99f,
+				z + Random::getRandom(-0.02f, 0.02f));
+			Quaternion orientation(1, 0, Random::getRandom(-0.02f, 0.02f), 0);
+			orientation.normalize();
+			positions.push_back(position);
+			orientations.push_back(orientation);
+
+			boxes[index].halfSize = halfSize;
+			boxes[index].body = &body;
+			index++;
+		}
+
+		groundBody.setInverseMass(0);
+		ground.direction = Vector3(0, 1, 0);
+		ground.offset = 0;
+		ground.body = &groundBody;
+
+		restoreBodies();
+		generateContacts(height, depth);
+		working = contacts;
+	}
+
+	unsigned getBodyCount() const
+	{
+		return bodies.size();
+	}
+
+	unsigned getContactCount() const
+	{
+		return contacts.size();
+	}
+
+	//Gets the contacts to resolve, as they were after the last restore
+	Contact* getContacts()
+	{
+		return &working[0];
+	}
+
+	//Puts the bodies and the contacts back to how they started
+	void restore()
+	{
+		restoreBodies();
+		working = contacts;
+	}
+
+	/**
+	* Sums the positions and velocities of the bodies with a different
+	* weight for each axis, to compare the results of two runs.
+	*/
+	double getChecksum() const
+	{
+		double sum = 0;
+		for (auto& body : bodies)
+		{
+			Vector3 p = body.getPosition() + body.getVelocity() * 10 + body.getRotation() * 100;
+			sum += p.x * 1.0 + p.y * 3.0 + p.z * 7.0;
+		}
+		return sum;
+	}
+
+	//Checks that no body was sent off to a non-finite position
+	bool isFinite() const
+	{
+		double sum = getChecksum();
+		return sum == sum && sum - sum == 0;
+	}
+
+protected:
+	void restoreBodies()
+	{
+		for (unsigned i = 0; i < bodies.size(); i++)
+		{
+			RigidBody& body = bodies[i];
+			body.setPosition(positions[i]);
+			body.setOrientation(orientations[i]);
+			body.setVelocity(Vector3(0, -9.81f * PILE_STEP, 0));
+			body.setRotation(Vector3());
+			body.setAwake(true);
+			body.calculateDerivedData();
+			boxes[i].calculateInternals();
+		}
+		groundBody.calculateDerivedData();
+		ground.calculateInternals();
+	}
+
+	//Checks the boxes of the bottom layer against the ground, and each box against its neighbours
+	void generateContacts(unsigned height, unsigned depth)
+	{
+		std::vector<Contact> pairContacts(MAX_PAIR_CONTACTS);
+		CollisionData data;
+		data.contactArray = &pairContacts[0];
+
+		auto add = [&](unsigned count)
+		{
+			contacts.insert(contacts.end(), pairContacts.begin(), pairContacts.begin() + count);
+		};
+		auto reset = [&]()
+		{
+			data.reset(MAX_PAIR_CONTACTS);
+			data.friction = 0.9f;
+			data.restitution = 0.1f;
+			data.tolerance = 0.01f;
+		};
+
+		for (unsigned i = 0; i < bodies.size(); i++)
+		{
+			unsigned y = i % height;
+			unsigned z = i / height % depth;
+			unsigned x = i / height / depth;
+			if (y == 0)
+			{
+				reset();
+				add(CollisionDetector::boxAndHalfSpace(boxes[i], ground, &data));
+			}
+
+			// Only the neighbours later in the grid, so each pair is checked once
+			for (unsigned j = i + 1; j < bodies.size(); j++)
+			{
+				unsigned otherY = j % height;
+				unsigned otherZ = j / height % depth;
+				unsigned otherX = j / height / depth;
+				if (otherX > x + 1) break;
+				if (otherY + 1 < y || otherY > y + 1 || otherZ + 1 < z || otherZ > z + 1) continue;
+
+				reset();
+				add(CollisionDetector::boxAndBox(boxes[i], boxes[j], &data));
+			}
+		}
+	}
+};
+
+/**
+* Gets the mean milliseconds the given function takes to resolve the
+* contacts of the pile, over the given number of runs. The pile is
+* restored before each run, outside the timing, and left as the last
+* run leaves it.
+*/
+template<class Resolve>
+double timeResolve(BoxPile& pile, unsigned runs, Resolve resolve)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::duration total = Clock::duration::zero();
+	for (unsigned run = 0; run < runs; run++)
+	{
+		pile.restore();
+		Clock::time_point start = Clock::now();
+		resolve(pile.getContacts(), pile.getContactCount());
+		total += Clock::now() - start;
+	}
+	return std::chrono::duration<double, std::milli>(total).count() / runs;
+}
@@ -0,0 +1,65 @@
+/**
+* Times the contact resolver on a pile of 2,000 boxes: the serial
+* worst-first resolver against the colored sequential impulse sweeps,
+* on the calling thread and shared out between workers. The result of
+* the sweeps doesn't depend on the number of workers, so the two
+* colored runs must leave the pile in the same place.
+*
+* Built by colored_solver_bench.vcxproj with the engine sources, without
+* the graphics, and run after each build. Takes the number of workers
+* as its argument, by default the number of hardware threads. Returns 0
+* if the colored runs agree, so a result that depends on the workers
+* fails the build.
+*/
+#include "box_pile.h"
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#define PILE_WIDTH 10
+#define PILE_HEIGHT 20
+#define PILE_DEPTH 10
+#define RUN_COUNT 5
+#define SWEEP_COUNT 10
+
+int main(int argc, char** argv)
+{
+	unsigned workerCount = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+	if (workerCount < 2) workerCount = 2;
+
+	BoxPile pile(PILE_WIDTH, PILE_HEIGHT, PILE_DEPTH);
+	printf("%u boxes, %u contacts\n", pile.getBodyCount(), pile.getContactCount());
+
+	// The serial resolver, with the iterations the world would give it
+	ContactResolver serial(pile.getContactCount() * 4);
+	double serialTime = timeResolve(pile, RUN_COUNT, [&](Contact* contacts, unsigned count)
+	{
+		serial.resolveContacts(contacts, count, PILE_STEP);
+	});
+	printf("worst first:                  %9.3f ms, checksum %.6f\n", serialTime, pile.getChecksum());
+
+	ContactResolver colored(pile.getContactCount() * 4);
+	colored.setMode(RESOLVER_SEQUENTIAL_IMPULSE, SWEEP_COUNT);
+	double coloredTime = timeResolve(pile, RUN_COUNT, [&](Contact* contacts, unsigned count)
+	{
+		colored.resolveContacts(contacts, count, PILE_STEP);
+	});
+	double coloredChecksum = pile.getChecksum();
+	printf("colored, calling thread:      %9.3f ms, checksum %.6f\n", coloredTime, coloredChecksum);
+
+	WorkerPool workers(workerCount);
+	colored.setWorkers(&workers);
+	double sharedTime = timeResolve(pile, RUN_COUNT, [&](Contact* contacts, unsigned count)
+	{
+		colored.resolveContacts(contacts, count, PILE_STEP);
+	});
+	double sharedChecksum = pile.getChecksum();
+	printf("colored, %2u workers:          %9.3f ms, checksum %.6f\n", workerCount, sharedTime, sharedChecksum);
+
+	if (sharedChecksum != coloredChecksum)
+	{
+		printf("the workers changed the result\n");
+		return 1;
+	}
+	return 0;
+}
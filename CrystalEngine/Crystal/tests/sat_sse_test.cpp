@@ -0,0 +1,172 @@
+/**
+* Checks the SSE separating axis kernel of box-box collisions against
+* the scalar one. Random pairs of boxes are run through both kernels,
+* which must pick the same axis with the same penetration and generate
+* the same contacts. The two only differ by rounding, so an axis is
+* allowed to change when two axes are within rounding of each other.
+*
+* Built by sat_sse_test.vcxproj with the engine sources, without the
+* graphics, and run after each build. Returns 0 if the kernels agree,
+* so a disagreement fails the build.
+*/
+#include <crystal\crystal.h>
+#include <cstdio>
+
+using namespace crystal;
+
+#define PAIR_COUNT 100000
+#define PENETRATION_TOLERANCE 0.0005f
+#define CONTACT_TOLERANCE 0.002f
+
+/**
+* The result of one kernel on a pair of boxes.
+*/
+struct KernelResult
+{
+	bool found;
+	real penetration;
+	unsigned axis;
+	unsigned singleAxis;
+	unsigned contactCount;
+	Contact contacts[MAX_PAIR_CONTACTS];
+};
+
+static void runKernel(const CollisionBox& one, const CollisionBox& two, bool sse, KernelResult& result)
+{
+	CollisionDetector::useSSE = sse;
+	result.found = CollisionDetector::boxAndBoxAxis(one, two, result.penetration, result.axis, result.singleAxis);
+
+	CollisionData data;
+	data.contactArray = result.contacts;
+	data.reset(MAX_PAIR_CONTACTS);
+	data.friction = 0;
+	data.restitution = 0;
+	data.tolerance = 0;
+	result.contactCount = CollisionDetector::boxAndBox(one, two, &data);
+}
+
+/**
+* Gets the penetration of the boxes along one of the 15 axes, as
+* numbered by CollisionDetector::boxAndBoxAxis, or REAL_MAX if the axis
+* is too short to use.
+*/
+static real penetrationOnAxis(const CollisionBox& one, const CollisionBox& two, unsigned index)
+{
+	Vector3 axis;
+	if (index < 3) axis = one.getAxis(index);
+	else if (index < 6) axis = two.getAxis(index - 3);
+	else axis = one.getAxis((index - 6) / 3) % two.getAxis((index - 6) % 3);
+	if (axis.squaredMagnitude() < 0.001f) return REAL_MAX;
+	axis.normalize();
+
+	real oneProject = one.halfSize.x * real_abs(axis * one.getAxis(0)) +
+		one.halfSize.y * real_abs(axis * one.getAxis(1)) +
+		one.halfSize.z * real_abs(axis * one.getAxis(2));
+	real twoProject = two.halfSize.x * real_abs(axis * two.getAxis(0)) +
+		two.halfSize.y * real_abs(axis * two.getAxis(1)) +
+		two.halfSize.z * real_abs(axis * two.getAxis(2));
+	real distance = real_abs((two.getAxis(3) - one.getAxis(3)) * axis);
+	return oneProject + twoProject - distance;
+}
+
+static Vector3 randomVector(real min, real max)
+{
+	return Vector3(Random::getRandom(min, max), Random::getRandom(min, max), Random::getRandom(min, max));
+}
+
+static bool isClose(const Vector3& a, const Vector3& b, real tolerance)
+{
+	return (a - b).magnitude() <= tolerance * (1 + a.magnitude());
+}
+
+static bool contactsMatch(const KernelResult& sse, const KernelResult& scalar)
+{
+	if (sse.contactCount != scalar.contactCount) return false;
+	for (unsigned i = 0; i < sse.contactCount; i++)
+	{
+		const Contact& a = sse.contacts[i];
+		const Contact& b = scalar.contacts[i];
+		if (!isClose(a.contactNormal, b.contactNormal, CONTACT_TOLERANCE)) return false;
+		if (!isClose(a.contactPoint, b.contactPoint, CONTACT_TOLERANCE)) return false;
+		if (real_abs(a.penetration - b.penetration) > CONTACT_TOLERANCE * (1 + real_abs(a.penetration))) return false;
+	}
+	return true;
+}
+
+int main()
+{
+	Random::SetSeed(1);
+	RigidBody bodies[2];
+	CollisionBox boxes[2];
+	for (unsigned i = 0; i < 2; i++) boxes[i].body = &bodies[i];
+
+	unsigned overlapping = 0, ties = 0, failures = 0;
+	for (unsigned pair = 0; pair < PAIR_COUNT; pair++)
+	{
+		for (unsigned i = 0; i < 2; i++)
+		{
+			// Half the pairs are axis aligned, to hit the parallel edge cases
+			bodies[i].setPosition(randomVector(-2, 2));
+			Quaternion orientation;
+			if (pair % 2)
+			{
+				orientation = Quaternion(Random::getRandom(-1, 1), Random::getRandom(-1, 1),
+					Random::getRandom(-1, 1), Random::getRandom(-1, 1));
+				orientation.normalize();
+			}
+			bodies[i].setOrientation(orientation);
+			bodies[i].calculateDerivedData();
+			boxes[i].halfSize = randomVector(0.1f, 1.5f);
+			boxes[i].calculateInternals();
+		}
+
+		KernelResult sse, scalar;
+		runKernel(boxes[0], boxes[1], true, sse);
+		runKernel(boxes[0], boxes[1], false, scalar);
+
+		bool match = true;
+		if (sse.found != scalar.found)
+		{
+			// Only boxes that just touch may be called apart by one kernel
+			real penetration = sse.found ? sse.penetration : scalar.penetration;
+			match = penetration <= PENETRATION_TOLERANCE;
+		}
+		else if (sse.found)
+		{
+			overlapping++;
+			match = real_abs(sse.penetration - scalar.penetration) <= PENETRATION_TOLERANCE * (1 + scalar.penetration);
+			if (match && (sse.axis != scalar.axis || sse.singleAxis != scalar.singleAxis))
+			{
+				// A different axis is only allowed when both penetrate as far
+				real one = penetrationOnAxis(boxes[0], boxes[1], sse.axis);
+				real two = penetrationOnAxis(boxes[0], boxes[1], scalar.axis);
+				match = real_abs(one - two) <= PENETRATION_TOLERANCE * (1 + two);
+				if (match) ties++;
+			}
+			else if (match)
+			{
+				match = contactsMatch(sse, scalar);
+			}
+		}
+		else
+		{
+			// Separated boxes must be separated along the same axis
+			match = sse.axis == scalar.axis;
+		}
+
+		if (!match)
+		{
+			if (failures < 10)
+			{
+				printf("pair %u: sse found %d axis %u pen %f, scalar found %d axis %u pen %f, contacts %u/%u\n",
+					pair, (int)sse.found, sse.axis, sse.penetration,
+					(int)scalar.found, scalar.axis, scalar.penetration, sse.contactCount, scalar.contactCount);
+			}
+			failures++;
+		}
+	}
+	CollisionDetector::useSSE = true;
+
+	printf("%u pairs, %u overlapping, %u axis ties, %u failures\n", PAIR_COUNT, overlapping, ties, failures);
+	return failures == 0 ? 0 : 1;
+}